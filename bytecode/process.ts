@@ -389,6 +389,23 @@ function genJmpTables(spec: Spec) {
     }
     r += "expr_invalid\n\n"
 
+    // code, handler, kind, and whether it takes a number; one label each in vm_ops.c
+    const ops = sortByCode(spec.ops).filter(obj => !obj.name.startsWith("removed_"))
+    const cont = (l: string) => l.padEnd(99) + "\\\n"
+    r += "// clang-format off\n" + cont("#define DEVS_OP_LIST(X)")
+    r += ops
+        .map(obj => {
+            const kind = obj.isExpr ? "EXPR" : "STMT"
+            const code = `DEVS_${sig(obj)}_${obj.name.toUpperCase()}`
+            const handler = `${sig(obj).toLowerCase()}_${obj.name}`
+            return `    X(${code}, ${handler}, ${kind}, ${
+                obj.takesNumber ? 1 : 0
+            })`
+        })
+        .map((l, i) => (i == ops.length - 1 ? l + "\n" : cont(l)))
+        .join("")
+    r += "// clang-format on\n\n"
+
     return r
 }
 
@@ -192,7 +192,10 @@ export class ImgFunction {
                             idx = s.jmpTrg.index
                         } else if (s.opcode == Op.STMTx_TRY) {
                             idx++
-                        } else if (s.opcode == Op.STMTx1_JMP_Z) {
+                        } else if (
+                            s.opcode == Op.STMTx1_JMP_Z ||
+                            s.opcode == Op.STMTx2_JMP_LT_Z
+                        ) {
                             find(idx + 1)
                             idx = s.jmpTrg.index
                         } else {
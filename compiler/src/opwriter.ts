@@ -196,6 +196,11 @@ export function literal(v: number | boolean) {
     return r
 }
 
+// can v be written as arguments of a fused opcode in place of op?
+function isFusable(v: Value, op: Op) {
+    return v && !v.isLiteral && !v.isMemRef && v.op == op
+}
+
 export function nonEmittable() {
     const r = new Value()
     r.op = BinFmt.FIRST_NON_OPCODE + 0x100
@@ -483,7 +488,12 @@ export class OpWriter {
         cond?.adopt()
         this.spillAllStateful()
 
-        if (cond) this.writeValue(cond)
+        if (!op && isFusable(cond, Op.EXPR2_LT)) {
+            cond.flags |= VF_IS_WRITTEN
+            this.writeValue(cond.args[0])
+            this.writeValue(cond.args[1])
+            op = Op.STMTx2_JMP_LT_Z
+        } else if (cond) this.writeValue(cond)
 
         const off0 = this.location()
         if (!op) op = cond ? Op.STMTx1_JMP_Z : Op.STMTx_JMP
@@ -668,6 +678,11 @@ export class OpWriter {
     }
 
     private writeArgs(op: Op, args: Value[]) {
+        if (op == Op.STMTx1_STORE_LOCAL && isFusable(args[1], Op.EXPR2_ADD)) {
+            args[1].flags |= VF_IS_WRITTEN
+            args = [args[0], ...args[1].args]
+            op = Op.STMTx2_ADD_STORE_LOCAL
+        }
         let i = 0
         if (opTakesNumber(op)) i = 1
         while (i < args.length) {
@@ -678,7 +693,11 @@ export class OpWriter {
         if (opTakesNumber(op)) {
             assert(args[0].isLiteral, `exp literal for op=${Op[op]} ${args[0]}`)
             const nval = args[0].numValue
-            if (op == Op.STMTx1_STORE_LOCAL) this.saveLocalIdx(nval)
+            if (
+                op == Op.STMTx1_STORE_LOCAL ||
+                op == Op.STMTx2_ADD_STORE_LOCAL
+            )
+                this.saveLocalIdx(nval)
             this.writeInt(nval)
         }
     }
@@ -735,6 +754,12 @@ export class OpWriter {
                 assert(this.binary[idx] == Op.EXPRx_MAKE_CLOSURE)
                 this.binary[idx] = Op.EXPRx_STATIC_FUNCTION
             }
+            delete this.closureRefs[key]
+        }
+        // lets the runtime reuse activations of this function once it returns
+        if (Object.keys(this.closureRefs).length == 0) {
+            this.funFlags |= FunctionFlag.NO_CLOSURES
+            this.desc[11] = this.funFlags
         }
     }
 
@@ -242,10 +242,50 @@ function testEnumToString() {
     assert(enumTest + "" === "1", "enum tostring in concatenation")
 }
 
+// local = x + y and loop conditions compile to add_store_local and jmp_lt_z
+function testFusedOps(big: number, half: number, str: string) {
+    let sum = 0
+    for (let i = 0; i < 10; i++) sum = sum + i
+    assert(sum === 45, "fused int")
+
+    let over = big + 1
+    assert(over === 2147483648, "fused overflow")
+    let under = -big - 1
+    under = under + -1
+    assert(under === -2147483649, "fused underflow")
+    let cnt = 0
+    for (let k = big - 1; k < big + 2; k++) cnt++
+    assert(cnt === 3, "fused lt overflow")
+
+    let x = half
+    let n = 0
+    while (x < 3) {
+        x = x + 1
+        n++
+    }
+    assert(n === 3 && x === 3.5, "fused double")
+    while (NaN < x) n++
+    assert(n === 3, "fused NaN")
+
+    let s = str
+    s = s + 1
+    assert(s === "a1", "fused str+num")
+    let t = n + str
+    assert(t === "3a", "fused num+str")
+    let m = 0
+    while (str < "b") {
+        str = str + "x"
+        m++
+        if (m > 5) break
+    }
+    assert(m === 6, "fused str lt")
+}
+
 testComma()
 testNums()
 testNaN()
 testUnaryPlus()
 testEnumToString()
+testFusedOps(0x7fffffff, 0.5, "a")
 
 
@@ -347,6 +347,30 @@ function endFn(win?: boolean) {
     assert(win === undefined, "lp1")
 }
 
+function mkLate(k: number) {
+    let x: any = null
+    const f = () => x
+    // stored after the closure is made, when the frame may have been promoted already
+    x = { k }
+    return f
+}
+
+function mkNone(k: number) {
+    return k + 1
+}
+
+function testLateCapture() {
+    const fns: (() => any)[] = []
+    for (let i = 0; i < 30; ++i) {
+        // alternate with pooled frames of the same size
+        assert(mkNone(i) === i + 1, "lc0")
+        fns.push(mkLate(i))
+        const tmp = [i, i + 1, { i }]
+        assert(tmp.length === 3, "lc1")
+    }
+    for (let i = 0; i < fns.length; ++i) assert(fns[i]().k === i, "lc2")
+}
+
 function testLambdasWithMoreParams() {
     function a(f: (x: number, v: string, y: number) => void) {
         f(1, ds._id("a") + "X12b", 7)
@@ -376,3 +400,4 @@ runInl()
 
 testUndef()
 testLambdasWithMoreParams()
+testLateCapture()
@@ -234,4 +234,85 @@ function testAnon() {
 
 testAnon()
 
+// instances made by constructors start with a shared shape, and switch to their own
+// dictionary when they can't follow it anymore
+class Pt {
+    x: number
+    y: number
+    z: number
+    constructor(x: number) {
+        this.x = x
+        this.y = x + 1
+        this.z = x + 2
+    }
+}
+
+function ptSum(p: Pt) {
+    return p.x + p.y + p.z
+}
+
+function keysOf(o: any) {
+    return Object.keys(o).join(",")
+}
+
+function checkPt(p: any, x: number, keys: string, m: string) {
+    assert(p.x === x && p.y === x + 1 && p.z === x + 2, m)
+    assert(ptSum(p) === 3 * x + 3, m + " ic")
+    assert(keysOf(p) === keys, m + " keys")
+}
+
+function testShapes() {
+    msg("shapes")
+    const shaped = new Pt(1)
+    for (let i = 0; i < 3; ++i) checkPt(shaped, 1, "x,y,z", "shaped")
+
+    const del: any = new Pt(10)
+    del.w = 5
+    delete del.y
+    assert(keysOf(del) === "x,z,w", "delete keys")
+    assert(del.y === undefined && del.w === 5, "delete")
+    del.y = 11
+    checkPt(del, 10, "x,z,w,y", "delete")
+    checkPt(shaped, 1, "x,y,z", "delete other")
+
+    const big: any = new Pt(20)
+    let keys = "x,y,z"
+    const names = ["k0", "k1", "k2", "k3", "k4", "k5", "k6", "k7", "k8", "k9"]
+    for (let i = 0; i < 2 * names.length; ++i) {
+        const k = i < names.length ? names[i] : names[i - names.length] + "b"
+        big[k] = i
+        keys += "," + k
+    }
+    checkPt(big, 20, keys, "big")
+    assert(big.k9 === 9 && big.k0b === 10 && big.k9b === 19, "big fields")
+
+    const dyn: any = new Pt(30)
+    dyn["d" + ds._id("yn")] = 7
+    checkPt(dyn, 30, "x,y,z,dyn", "dyn")
+    assert(dyn.dyn === 7, "dyn field")
+
+    // more distinct key orders than there can be shapes
+    const objs: any[] = []
+    const exp: string[] = []
+    for (let i = 0; i < names.length; ++i)
+        for (let j = 0; j < names.length; ++j) {
+            if (i == j) continue
+            const o: any = new Pt(i)
+            o[names[i]] = j
+            o[names[j]] = i
+            objs.push(o)
+            exp.push(names[i] + "," + names[j])
+        }
+    for (let n = 0; n < objs.length; ++n) {
+        const o = objs[n]
+        const ks = exp[n].split(",")
+        checkPt(o, o.x, "x,y,z," + exp[n], "many")
+        assert(o[ks[0]] === names.indexOf(ks[1]), "many 0")
+        assert(o[ks[1]] === names.indexOf(ks[0]), "many 1")
+    }
+    checkPt(new Pt(40), 40, "x,y,z", "after many")
+}
+
+testShapes()
+
 
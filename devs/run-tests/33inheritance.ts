@@ -170,9 +170,61 @@ function run3() {
     msg("Ifaces.runDONE")
 }
 
+// inherited fields are cached per call site; see devs_object_get_cached()
+function who(o: any) {
+    return o.who() + o.tag
+}
+
+function churn() {
+    let keep: any[] = []
+    for (let i = 0; i < 3000; ++i) keep = [i, keep.length, "x" + i]
+    return keep.length
+}
+
+function testFieldCache() {
+    msg("fieldCache")
+    const base: any = { who: () => "base", tag: 1 }
+    const mid: any = {}
+    const leaf: any = {}
+    const other: any = {}
+    Object.setPrototypeOf(mid, base)
+    Object.setPrototypeOf(leaf, mid)
+    Object.setPrototypeOf(other, mid)
+    for (let i = 0; i < 5; ++i) assert(who(leaf) === "base1", "warm")
+
+    // shadowed by an own key, on one receiver only
+    leaf.who = () => "own"
+    assert(who(leaf) === "own1", "own")
+    assert(who(other) === "base1", "own other")
+    delete leaf.who
+    assert(who(leaf) === "base1", "own deleted")
+
+    // shadowed on the prototype in between
+    mid.tag = 2
+    assert(who(leaf) === "base2", "mid")
+    mid["w" + "ho"] = () => "mid"
+    assert(who(leaf) === "mid2", "mid computed")
+    assert(who(other) === "mid2", "mid other")
+
+    // prototype replaced after the site warmed up
+    for (let i = 0; i < 5; ++i) assert(who(other) === "mid2", "warm2")
+    Object.setPrototypeOf(other, { who: () => "swap", tag: 3 })
+    assert(who(other) === "swap3", "swapped")
+    assert(who(leaf) === "mid2", "not swapped")
+
+    // entries survive, or are dropped by, collections
+    assert(churn() === 3, "churn")
+    assert(who(leaf) === "mid2", "gc")
+    assert(who(other) === "swap3", "gc other")
+    delete mid.who
+    assert(churn() === 3, "churn2")
+    assert(who(leaf) === "base2", "gc deleted")
+}
+
 run()
 run1()
 run2()
 run3()
+testFieldCache()
 
 
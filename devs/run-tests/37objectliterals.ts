@@ -158,7 +158,45 @@ function testLam() {
     x = null // release memory
 }
 
+// objects with DEVS_MAP_HASH_MIN_CAPACITY keys or more are looked up through a hash index
+function testMapIndex() {
+    msg("mapIndex")
+    const o: any = {}
+    const n = 40
+    for (let i = 0; i < n; ++i) o["k" + i] = i
+    // pairs with the same low 10 bits of the hash, so they probe the same index entries
+    const coll = ["c78", "c126", "c79", "c127"]
+    for (let i = 0; i < coll.length; ++i) o[coll[i]] = 100 + i
+    for (let i = 0; i < n; ++i) assert(o["k" + i] === i, "get")
+    assert(o.k7 === 7 && o.c126 === 101, "get literal")
+    assert(Object.keys(o).length === n + coll.length, "len")
+
+    let keys = ""
+    for (let i = 0; i < n; ++i) if (i % 3) keys += "k" + i + ","
+    for (let i = 0; i < n; i += 3) delete o["k" + i]
+    delete o.c78
+    delete o["c" + "79"]
+    keys += "c126,c127"
+    assert(Object.keys(o).join(",") === keys, "keys after delete")
+    for (let i = 0; i < n; ++i) assert(o["k" + i] === (i % 3 ? i : undefined), "get after delete")
+    assert(o.c78 === undefined && o.c79 === undefined, "deleted coll")
+    assert(o.c126 === 101 && o.c127 === 103, "coll after delete")
+
+    for (let i = 0; i < n; i += 3) {
+        o["k" + i] = -i
+        keys += ",k" + i
+    }
+    o["c7" + "8"] = 200
+    o.c79 = 201
+    keys += ",c78,c79"
+    assert(Object.keys(o).join(",") === keys, "keys after re-add")
+    for (let i = 0; i < n; ++i) assert(o["k" + i] === (i % 3 ? i : -i), "get after re-add")
+    assert(o.k0 === 0 && o.k3 === -3 && o.k4 === 4, "get literal after re-add")
+    assert(o.c78 === 200 && o.c79 === 201 && o.c126 === 101 && o.c127 === 103, "coll")
+}
+
 runObjLit()
 testLam()
+testMapIndex()
 
 
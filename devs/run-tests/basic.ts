@@ -882,9 +882,14 @@ async function testFibers() {
 
     await ds.sleep(10)
     const f0 = ds.Fiber.self()
+    const steps0 = f0.steps
     const f1 = logloop.start()
     ds.assert(f0 !== f1)
     await ds.sleep(50)
+    ds.assert(f0.steps > steps0)
+    ds.assert(f1.steps > 0)
+    ds.assert(f1.runTime >= 0)
+    ds.assert(f0.runTime >= 0)
     f1.terminate()
     console.log(i)
     ds.assert(4 <= i && i <= 6)
@@ -898,6 +903,36 @@ async function testFibers() {
     console.log("fibers OK!")
 }
 
+async function testPreempt() {
+    let ticks = 0
+    let done = false
+
+    async function ticker() {
+        while (!done) {
+            ticks++
+            await ds.sleep(0)
+        }
+    }
+
+    const f0 = ds.Fiber.self()
+    const quantum = f0.quantum
+    f0.setQuantum(100)
+    ds.assert(f0.quantum === 100)
+    ticker.start()
+    await ds.sleep(0)
+
+    // no await in the loop; the ticker only runs when this fiber is preempted
+    const t0 = ticks
+    let n = 0
+    while (ticks < t0 + 3 && n < 5000) n++
+    done = true
+    ds.assert(ticks >= t0 + 3)
+    ds.assert(n > 0)
+
+    f0.setQuantum(quantum)
+    console.log("preempt OK!")
+}
+
 class FooError extends Error {}
 
 function testCtorError() {
@@ -1102,6 +1137,7 @@ await testSetTimeout()
 testRest()
 const s = new SuiteNode()
 await testFibers()
+await testPreempt()
 testCtorError()
 testIgnoredAnd()
 testQDot()
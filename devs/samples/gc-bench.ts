@@ -0,0 +1,55 @@
+import * as ds from "@devicescript/core"
+
+// Builds structures that are deep (a linked list) and wide (an array of objects),
+// and keeps allocating garbage while they are alive, so that the collector has
+// to mark them many times. Compare the times before and after GC changes.
+
+interface Node {
+    value: number
+    next: Node
+}
+
+function buildList(len: number) {
+    let head: Node = null
+    for (let i = 0; i < len; ++i) head = { value: i, next: head }
+    return head
+}
+
+function buildArray(len: number) {
+    const arr: { x: number; y: number; name: string }[] = []
+    for (let i = 0; i < len; ++i) arr.push({ x: i, y: -i, name: "n" + i })
+    return arr
+}
+
+function churn(rounds: number) {
+    let s = 0
+    for (let i = 0; i < rounds; ++i) {
+        const tmp = [i, i + 1, i + 2]
+        s += tmp.length
+    }
+    return s
+}
+
+function bench(name: string, f: () => void) {
+    const t0 = ds.millis()
+    f()
+    console.log(`${name}: ${ds.millis() - t0}ms`)
+}
+
+let list: Node
+let arr: { x: number; y: number; name: string }[]
+
+bench("list", () => {
+    list = buildList(2000)
+})
+bench("array", () => {
+    arr = buildArray(1000)
+})
+bench("churn", () => {
+    churn(20000)
+})
+
+let n = 0
+for (let p = list; p; p = p.next) n++
+ds.assert(n === 2000, "list")
+ds.assert(arr[999].name === "n999", "array")
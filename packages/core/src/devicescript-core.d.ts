@@ -161,12 +161,33 @@ declare module "@devicescript/core" {
          */
         readonly suspended: boolean
 
+        /**
+         * Number of instructions the fiber executed so far.
+         */
+        readonly steps: number
+
+        /**
+         * Time in milliseconds the fiber spent running (not sleeping or waiting).
+         */
+        readonly runTime: number
+
+        /**
+         * Number of instructions after which the fiber is paused, so that other fibers can run,
+         * or `0` if it only stops at `await`.
+         */
+        readonly quantum: number
+
         /**
          * If the fiber is currently suspended, mark it for resumption, passing the specified value.
          * Otherwise, throw a `RangeError`.
          */
         resume(v: any): void
 
+        /**
+         * Set the `quantum` of the fiber; takes effect when it is next resumed.
+         */
+        setQuantum(steps: number): void
+
         /**
          * Stop given fiber (which can be current fiber).
          */
@@ -23,6 +23,9 @@ static void setup_ctx(devs_ctx_t *ctx, const uint8_t *img) {
     if (ctx->error_code)
         return;
 
+    if (devs_get_global_flags() & DEVS_FLAG_CPU_PROFILE)
+        devs_cpu_profile_start(ctx);
+
     devs_fiber_sync_now(ctx);
     devs_jd_reset_packet(ctx);
 
@@ -159,6 +162,8 @@ static void clear_ctx(devs_ctx_t *ctx) {
     devs_enter(ctx);
     devs_regcache_free_all(&ctx->regcache);
     devs_fiber_free_all_fibers(ctx);
+    devs_fn_cache_free(ctx);
+    devs_cpu_profile_stop(ctx);
     devs_free(ctx, ctx->globals);
     for (unsigned i = 0; i < ctx->num_roles; ++i)
         devs_free(ctx, ctx->roles[i]);
@@ -29,10 +29,41 @@ unsigned devs_error_code(devs_ctx_t *ctx, unsigned *pc);
 void devs_client_event_handler(devs_ctx_t *ctx, int event_id, void *arg0, void *arg1);
 void devs_free_ctx(devs_ctx_t *ctx);
 
+// Garbage collector counters, kept for the lifetime of the heap; the totals wrap around.
+typedef struct {
+    uint32_t num_gc; // finished collections, minor and full
+    uint32_t num_full_gc;
+    uint32_t num_compactions;
+    uint32_t total_pause_us;
+    uint32_t max_pause_us;
+    // as of the end of the last collection
+    uint32_t survivors; // objects
+    uint32_t survivor_bytes;
+    uint32_t free_bytes;
+    uint32_t max_free_block;
+    uint32_t fragmentation;   // 1 - max_free_block / free_bytes, in 1/1000
+    uint32_t alloc_bytes[16]; // indexed by DEVS_GC_TAG_*
+} devs_gc_stats_t;
+
+void devs_get_gc_stats(devs_ctx_t *ctx, devs_gc_stats_t *dst);
+
+// can be called from a timer interrupt, or a signal handler on any thread; the VM takes
+// the sample before its next opcode
+void devs_cpu_profile_tick(void);
+// prints the profile so far with DMESG(); it's also printed when the program stops
+void devs_cpu_profile_dump(devs_ctx_t *ctx);
+// prints opcode counts (when built with DEVS_OP_STATS) with DMESG()
+void devs_vm_dump_op_stats(void);
+
 void devs_panic_handler(int exitcode);
 void devs_deploy_handler(int exitcode);
 
 #define DEVS_FLAG_GC_STRESS (1U << 0)
+// profile programs started from now on (when built with DEVS_CPU_PROFILE)
+#define DEVS_FLAG_CPU_PROFILE (1U << 1)
+// with DEVS_FLAG_CPU_PROFILE, sample when devs_cpu_profile_tick() is called, not every
+// DEVS_CPU_PROFILE_STEPS opcodes
+#define DEVS_FLAG_CPU_PROFILE_TIMER (1U << 2)
 
 void devs_set_global_flags(uint32_t global_flags);
 void devs_reset_global_flags(uint32_t global_flags);
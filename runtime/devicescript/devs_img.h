@@ -44,6 +44,8 @@ static inline value_t devs_img_get_float(devs_img_t img, uint32_t idx) {
 }
 
 const char *devs_builtin_string_by_idx(unsigned idx);
+// returns DEVS_BUILTIN_STRING_* index of given string or -1
+int devs_builtin_string_lookup(const char *str, unsigned len);
 const char *devs_img_get_utf8(devs_img_t img, uint32_t idx, unsigned *size);
 const char *devs_img_fun_name(devs_img_t img, unsigned fidx);
 bool devs_img_stridx_ok(devs_img_t img, uint32_t stridx);
@@ -6,6 +6,8 @@
 
 #include "devicescript.h"
 
+#include <signal.h> // sig_atomic_t
+
 #include "jd_protocol.h"
 #include "jd_client.h"
 #include "jacdac/dist/c/devicescriptcondition.h"
@@ -21,7 +23,66 @@
 
 // this can't be more than a week; unit = ms
 #define DEVS_MAX_REG_VALIDITY (15 * 60 * 1000)
+// opcodes a fiber can run without yielding by itself (preemption doesn't count)
 #define DEVS_MAX_STEPS (128 * 1024)
+
+// decode a function into fixed-width form once it was entered this many times; 0 to disable
+#ifndef DEVS_FN_CACHE_THRESHOLD
+#define DEVS_FN_CACHE_THRESHOLD 16
+#endif
+// total size of decoded functions (8 bytes per byte of bytecode); when full, functions called
+// less often are evicted
+#ifndef DEVS_FN_CACHE_MAX_BYTES
+#define DEVS_FN_CACHE_MAX_BYTES (8 * 1024)
+#endif
+// decoded functions are pinned, so they also take at most 1/DEVS_FN_CACHE_HEAP_SHARE of the heap
+// (2k on a 64k heap)
+#ifndef DEVS_FN_CACHE_HEAP_SHARE
+#define DEVS_FN_CACHE_HEAP_SHARE 32
+#endif
+// don't allocate bound functions for obj.method(...) calls; see devs_bind_stack0()
+#ifndef DEVS_DEFER_METHOD_BIND
+#define DEVS_DEFER_METHOD_BIND 1
+#endif
+// returned frames of each size that are kept for reuse by later calls, unless a closure
+// captured them; 0 to disable
+#ifndef DEVS_ACT_POOL_DEPTH
+#define DEVS_ACT_POOL_DEPTH 4
+#endif
+// frames with more words of locals and try frames than this are left to the GC
+#ifndef DEVS_ACT_POOL_MAX_WORDS
+#define DEVS_ACT_POOL_MAX_WORDS 15
+#endif
+// rewrite int-heavy opcodes in decoded functions into int-only forms, after seeing their operands
+#ifndef DEVS_QUICKEN
+#define DEVS_QUICKEN 0
+#endif
+// sampling CPU profiler, started for programs run with DEVS_FLAG_CPU_PROFILE; see profile.c
+#ifndef DEVS_CPU_PROFILE
+#define DEVS_CPU_PROFILE 0
+#endif
+// opcodes between samples, unless sampled on devs_cpu_profile_tick()
+#ifndef DEVS_CPU_PROFILE_STEPS
+#define DEVS_CPU_PROFILE_STEPS 1000
+#endif
+// number of distinct call stacks kept
+#ifndef DEVS_CPU_PROFILE_SIZE
+#define DEVS_CPU_PROFILE_SIZE 64
+#endif
+// default for Fiber.setQuantum(): when non-zero, a fiber that ran this many opcodes yields at
+// the next statement boundary, so that other fibers and packets get a turn; note that programs
+// may depend on code between awaits running without interruption
+#ifndef DEVS_FIBER_QUANTUM
+#define DEVS_FIBER_QUANTUM 0
+#endif
+// buckets in the lookup of fibers by handle tag and by function; power of 2
+#ifndef DEVS_FIBER_HASH_SIZE
+#define DEVS_FIBER_HASH_SIZE 16
+#endif
+// buckets in the lookup of bound roles by device; power of 2
+#ifndef DEVS_ROLE_HASH_SIZE
+#define DEVS_ROLE_HASH_SIZE 16
+#endif
 #define DEVS_NO_ROLE 0xffff
 
 #define DEVS_MAX_STACK_TRACE_FRAMES 16
@@ -39,6 +100,11 @@ typedef void (*devs_resume_cb_t)(devs_ctx_t *ctx, void *userdata);
 
 typedef struct devs_fiber {
     struct devs_fiber *next;
+    struct devs_fiber *next_by_tag;
+    struct devs_fiber *next_by_fidx;
+    struct devs_fiber *next_ready;
+    struct devs_fiber *next_waiting;
+    struct devs_fiber *next_awaiting;
 
     union {
         struct {
@@ -57,7 +123,8 @@ typedef struct devs_fiber {
 
     uint8_t pending : 1;
     uint8_t role_wkp : 1;
-    uint8_t reserved_flag : 2;
+    uint8_t ready : 1; // in ctx->ready_first list
+    uint8_t waiting : 1; // in ctx->fibers_waiting
 
     uint8_t stack_depth;
 
@@ -65,11 +132,17 @@ typedef struct devs_fiber {
     uint16_t service_command;
 
     uint16_t bottom_function_idx; // the id of function at the bottom of the stack
+    uint16_t sleep_idx;           // 1 + position in ctx->sleeping, 0 if wake_time not set
 
     uint32_t wake_time;
 
     uint32_t handle_tag;
 
+    uint32_t num_steps;  // opcodes run, in total
+    uint32_t busy_steps; // opcodes run since the fiber last yielded by itself
+    uint32_t quantum;    // opcodes before the fiber is preempted, 0 for never
+    uint64_t run_time;   // in microseconds
+
     value_t ret_val;
 
     devs_activation_t *activation;
@@ -101,6 +174,10 @@ typedef struct {
     value_t name;
     jd_role_t *jdrole;
     devs_map_t *attached;
+    // when bound; see devs_jd_role_changed()
+    uint64_t device_id;
+    uint16_t next_by_device; // 1 + index of next role in the bucket, 0 at the end
+    uint8_t indexed;
 } devs_role_t;
 
 #define DEVS_BRK_FLAG_STEP 0x01
@@ -115,6 +192,76 @@ typedef struct {
 // has to be under 0xff
 #define DEVS_BRK_MAX_COUNT 0xf0
 
+typedef struct {
+    int32_t literal;
+    uint8_t op;
+    uint8_t size;     // 0 if not a start of instruction
+    uint16_t orig_op; // when op is DEVS_QOP_*
+} devs_decoded_op_t;
+
+// max. number of hidden classes (shapes) for objects created by constructors; 0 to disable
+#ifndef DEVS_MAX_SHAPES
+#define DEVS_MAX_SHAPES 64
+#endif
+// objects with more keys are kept in dictionary mode
+#ifndef DEVS_SHAPE_MAX_KEYS
+#define DEVS_SHAPE_MAX_KEYS 16
+#endif
+// dictionary-mode objects with this capacity or more get a hash index; 0 to disable
+#ifndef DEVS_MAP_HASH_MIN_CAPACITY
+#define DEVS_MAP_HASH_MIN_CAPACITY 16
+#endif
+
+// inline cache for field access opcodes; has to be a multiple of DEVS_FIELD_IC_WAYS
+// and the number of sets a power of 2; 0 to disable
+#ifndef DEVS_FIELD_IC_SIZE
+#define DEVS_FIELD_IC_SIZE 32
+#endif
+#define DEVS_FIELD_IC_WAYS 2
+#define DEVS_FIELD_IC_NO_SLOT 0xffff
+
+typedef struct {
+    devs_pc_t pc;  // 0 if unused
+    uint16_t slot; // key index in holder (or receiver when holder is NULL)
+    uint16_t epoch;
+    devs_maplike_t *head;   // first object in the proto chain after the receiver
+    devs_maplike_t *holder; // NULL when found in receiver, or in a static proto or spec
+    value_t value;          // when slot == DEVS_FIELD_IC_NO_SLOT
+} devs_field_ic_t;
+
+typedef struct {
+    uint16_t num_calls; // saturates; halved on every eviction round
+    devs_decoded_op_t *ops;
+} devs_fn_cache_entry_t;
+
+typedef struct {
+    uint16_t num_functions;
+    uint32_t used_bytes;
+    uint32_t max_bytes;
+    // last lookup, so that the VM doesn't need to find it on every opcode
+    const devs_function_desc_t *last_func;
+    devs_decoded_op_t *last_ops;
+    devs_fn_cache_entry_t entries[0];
+} devs_fn_cache_t;
+
+#if DEVS_CPU_PROFILE
+typedef struct {
+    uint32_t count;
+    uint8_t depth;
+    uint8_t truncated; // the outermost frames didn't fit
+    uint16_t frames[DEVS_MAX_STACK_TRACE_FRAMES]; // function indices, innermost first
+} devs_cpu_stack_t;
+
+typedef struct {
+    uint32_t countdown; // opcodes until the next sample
+    uint32_t steps;              // 0 when sampled on devs_cpu_profile_tick()
+    uint32_t num_samples;
+    uint32_t num_dropped; // samples with a new stack when the table was full
+    uint16_t num_stacks;
+    devs_cpu_stack_t stacks[DEVS_CPU_PROFILE_SIZE];
+} devs_cpu_profile_t;
+#endif
+
 #define DEVS_DBG_BRK_UNHANDLED_EXN 0x01
 #define DEVS_DBG_BRK_HANDLED_EXN 0x02
 
@@ -131,6 +278,8 @@ struct devs_ctx {
 
     value_t diag_field;
     value_t exn_val;
+    // 'this' for the_stack[0] when stack0_unbound
+    value_t stack0_this;
 
     devs_pc_t jmp_pc;
 
@@ -138,10 +287,13 @@ struct devs_ctx {
     uint8_t stack_top_for_gc;
     uint8_t _num_builtin_protos;
     uint8_t in_throw;
+    uint8_t preempted; // the current fiber ran out of its quantum
     uint8_t suspension;
     uint8_t dbg_en;
     uint8_t ignore_brk;
     uint8_t dbg_flags;
+    uint8_t stack0_unbound;
+    uint8_t defer_bind; // the next bind would be for the_stack[0]
     uint16_t num_roles;
 
     uint32_t literal_int;
@@ -157,7 +309,22 @@ struct devs_ctx {
     devs_fiber_t *curr_fiber;
 
     devs_fiber_t *fibers;
+    devs_fiber_t *fibers_by_tag[DEVS_FIBER_HASH_SIZE];
+    devs_fiber_t *fibers_by_fidx[DEVS_FIBER_HASH_SIZE];
+    // fibers in REG_GET or SEND_PKT, by role_idx and service_command
+    devs_fiber_t *fibers_waiting[DEVS_FIBER_HASH_SIZE];
+    // fibers in AWAITING; see devs_fiber_await()
+    devs_fiber_t *fibers_awaiting;
+    // fibers with wake_time set, as a binary heap; see devs_fiber_set_wake_time()
+    devs_fiber_t **sleeping;
+    uint16_t num_sleeping;
+    uint16_t sleeping_size;
+    uint16_t num_fibers;
+    // woken up with devs_fiber_role_wake(); these run before the sleeping ones
+    devs_fiber_t *ready_first;
+    devs_fiber_t *ready_last;
     devs_role_t **roles;
+    uint16_t roles_by_device[DEVS_ROLE_HASH_SIZE]; // 1 + index of first bound role, or 0
 
     // use devs_get_builtin_object()
     devs_map_t **_builtin_protos;
@@ -175,6 +342,29 @@ struct devs_ctx {
 
     devs_gc_t *gc;
 
+    devs_fn_cache_t *fn_cache;
+
+#if DEVS_ACT_POOL_DEPTH
+    // free frames by number of words after the header, linked through caller
+    devs_activation_t *act_pool[DEVS_ACT_POOL_MAX_WORDS + 1];
+    uint8_t act_pool_len[DEVS_ACT_POOL_MAX_WORDS + 1];
+#endif
+
+#if DEVS_CPU_PROFILE
+    devs_cpu_profile_t *cpu_profile;
+#endif
+
+    devs_shape_t *shape_root;
+    uint16_t num_shapes;
+
+#if DEVS_FIELD_IC_SIZE
+    // bumped on GC and whenever a cached inherited field may have become stale
+    uint16_t field_ic_epoch;
+    uint32_t field_ic_key_bloom;
+    uint32_t field_ic_dyn_key_bloom;
+    devs_field_ic_t field_ic[DEVS_FIELD_IC_SIZE];
+#endif
+
     devs_cfg_t cfg;
 
     devs_activation_t *step_fn;
@@ -196,6 +386,7 @@ struct devs_activation {
     devs_gc_object_t gc;
     devs_pc_t pc;
     devs_pc_t maxpc;
+    uint8_t captured; // by a closure, so it may outlive the call
     devs_activation_t *closure;
     devs_activation_t *caller;
     const devs_function_desc_t *func;
@@ -248,8 +439,34 @@ void devs_jd_send_logmsg(devs_ctx_t *ctx, char lev, value_t str);
 uint64_t devs_jd_server_device_id(void);
 void devs_jd_after_user(devs_ctx_t *ctx);
 
+// fncache.c
+void devs_fn_cache_enter(devs_ctx_t *ctx, unsigned fidx);
+void devs_fn_cache_free(devs_ctx_t *ctx);
+
+// profile.c
+#if DEVS_CPU_PROFILE
+void devs_cpu_profile_start(devs_ctx_t *ctx);
+void devs_cpu_profile_sample(devs_ctx_t *ctx);
+// prints the profile
+void devs_cpu_profile_stop(devs_ctx_t *ctx);
+// set by devs_cpu_profile_tick()
+extern volatile sig_atomic_t devs_cpu_profile_ticked;
+// called before every opcode
+static inline void devs_cpu_profile_step(devs_ctx_t *ctx) {
+    devs_cpu_profile_t *p = ctx->cpu_profile;
+    if (p && (--p->countdown == 0 || devs_cpu_profile_ticked))
+        devs_cpu_profile_sample(ctx);
+}
+#else
+static inline void devs_cpu_profile_start(devs_ctx_t *ctx) {}
+static inline void devs_cpu_profile_stop(devs_ctx_t *ctx) {}
+static inline void devs_cpu_profile_step(devs_ctx_t *ctx) {}
+#endif
+
 // fibers.c
 void devs_fiber_set_wake_time(devs_fiber_t *fiber, unsigned time);
+void devs_fiber_role_wake(devs_fiber_t *fiber);
+void devs_fiber_preempt(devs_ctx_t *ctx);
 void devs_fiber_sleep(devs_fiber_t *fiber, unsigned time);
 void devs_fiber_termiante(devs_fiber_t *fiber);
 void devs_fiber_yield(devs_ctx_t *ctx);
@@ -269,7 +486,7 @@ void devs_fiber_free_all_fibers(devs_ctx_t *ctx);
 unsigned devs_fiber_get_max_sleep(devs_ctx_t *ctx);
 
 // vm_main.c
-void devs_vm_exec_opcodes(devs_ctx_t *ctx);
+unsigned devs_vm_exec_opcodes(devs_ctx_t *ctx, unsigned maxsteps);
 bool devs_in_vm_loop(devs_ctx_t *ctx);
 uint8_t devs_fetch_opcode(devs_activation_t *frame, devs_ctx_t *ctx);
 
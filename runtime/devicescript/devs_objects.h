@@ -29,14 +29,37 @@ struct devs_maplike {
 };
 typedef const struct devs_maplike devs_maplike_t;
 
+// Hidden class - an immutable list of keys, shared between maps that got their keys
+// added in the same order. Shapes form a tree rooted at ctx->shape_root, where
+// each child has one more key than its parent.
+typedef struct devs_shape {
+    devs_gc_object_t gc; // DEVS_GC_TAG_SHAPE
+    devs_small_size_t length;
+    devs_small_size_t reserved;
+    struct devs_shape *first_child;
+    struct devs_shape *next_sibling;
+    value_t keys[0];
+} devs_shape_t;
+
 typedef struct {
     devs_gc_object_t gc;
     devs_maplike_t *proto;
     devs_small_size_t length;
     devs_small_size_t capacity;
+    // if shape is NULL, data[] holds interleaved keys and values ("dictionary mode")
+    // otherwise it holds values only, and keys are in shape->keys[]
     value_t *data;
+    devs_shape_t *shape;
 } devs_map_t;
 
+static inline value_t *devs_map_key_ptr(devs_map_t *map, unsigned idx) {
+    return map->shape ? &map->shape->keys[idx] : &map->data[idx * 2];
+}
+
+static inline value_t *devs_map_value_ptr(devs_map_t *map, unsigned idx) {
+    return map->shape ? &map->data[idx] : &map->data[idx * 2 + 1];
+}
+
 // same structure as devs_map_t but data[] field is different
 typedef struct {
     devs_gc_object_t gc;
@@ -52,6 +75,7 @@ typedef struct devs_builtin_proto {
     const devs_builtin_proto_entry_t *entries;
 } devs_builtin_proto_t;
 extern const devs_builtin_proto_t devs_builtin_protos[DEVS_BUILTIN_OBJECT___MAX + 1];
+extern const devs_builtin_proto_hash_t devs_builtin_proto_hashes[DEVS_BUILTIN_OBJECT___MAX + 1];
 
 static inline bool devs_is_builtin_proto(const void *ptr) {
     return (uintptr_t)((const devs_builtin_proto_t *)ptr - devs_builtin_protos) <
@@ -123,6 +147,7 @@ void devs_map_set(devs_ctx_t *ctx, devs_map_t *map, value_t key, value_t v);
 value_t devs_map_get(devs_ctx_t *ctx, devs_map_t *map, value_t key);
 int devs_map_delete(devs_ctx_t *ctx, devs_map_t *map, value_t key);
 void devs_map_clear(devs_ctx_t *ctx, devs_map_t *map);
+void devs_map_use_shape(devs_ctx_t *ctx, devs_map_t *map);
 void devs_map_copy_into(devs_ctx_t *ctx, devs_map_t *dst, devs_maplike_t *src);
 void devs_map_set_string_field(devs_ctx_t *ctx, devs_map_t *m, unsigned builtin_str, value_t msg);
 
@@ -146,6 +171,8 @@ int devs_array_insert(devs_ctx_t *ctx, devs_array_t *arr, unsigned idx, int coun
 void devs_array_pin_push(devs_ctx_t *ctx, devs_array_t *arr, value_t v);
 
 value_t devs_object_get(devs_ctx_t *ctx, value_t obj, value_t key);
+value_t devs_object_get_cached(devs_ctx_t *ctx, value_t obj, value_t key);
+void devs_field_ic_invalidate(devs_ctx_t *ctx);
 value_t devs_object_get_built_in_field(devs_ctx_t *ctx, value_t obj, unsigned idx);
 bool devs_instance_of(devs_ctx_t *ctx, value_t obj, devs_maplike_t *cls_proto);
 devs_maplike_t *devs_get_prototype_field(devs_ctx_t *ctx, value_t cls);
@@ -162,6 +189,8 @@ devs_maplike_t *devs_object_get_attached_enum(devs_ctx_t *ctx, value_t v);
 // DEVS_BUILTIN_OBJECT_*
 devs_maplike_t *devs_get_builtin_object(devs_ctx_t *ctx, unsigned idx);
 value_t devs_function_bind(devs_ctx_t *ctx, value_t obj, value_t v);
+// bind the function in the_stack[0] to ctx->stack0_this, if it was left unbound
+void devs_bind_stack0(devs_ctx_t *ctx);
 bool devs_is_service_spec(devs_ctx_t *ctx, const void *ptr);
 const devs_packet_spec_t *devs_decode_role_packet(devs_ctx_t *ctx, value_t v, unsigned *roleidx);
 const devs_service_spec_t *devs_value_to_service_spec(devs_ctx_t *ctx, value_t v);
@@ -239,10 +268,55 @@ void devs_gc_destroy(devs_gc_t *gc);
         { DEVS_GC_MK_TAG_BYTES(DEVS_GC_TAG_BUILTIN_PROTO, sizeof(devs_builtin_proto_t)) }          \
     }
 
+// When set, objects that survive a collection keep DEVS_GC_TAG_MASK_SCANNED ("old") and
+// are skipped by minor collections, unless recorded by devs_gc_write_barrier(). New objects are
+// allocated from a nursery block first, and minor collections only sweep that.
+#ifndef DEVS_GC_GENERATIONAL
+#define DEVS_GC_GENERATIONAL 1
+#endif
+
+// When set, full collections are started from devs_gc_step() (called by devs_fiber_poke()),
+// and clearing old marks, marking and sweeping are done there, DEVS_GC_SLICE_BUDGET blocks
+// at a time.
+#ifndef DEVS_GC_INCREMENTAL
+#define DEVS_GC_INCREMENTAL 1
+#endif
+
+#ifndef DEVS_GC_SLICE_BUDGET
+#define DEVS_GC_SLICE_BUDGET 512
+#endif
+
+// When set, and a full collection leaves enough free memory for a DEVS_GC_COMPACT_THRESHOLD
+// bytes allocation but not in one block, live objects are moved together by devs_gc_step().
+#ifndef DEVS_GC_COMPACT
+#define DEVS_GC_COMPACT 0
+#endif
+
+#ifndef DEVS_GC_COMPACT_THRESHOLD
+#define DEVS_GC_COMPACT_THRESHOLD 2048
+#endif
+
+// When set, every DEVS_ALLOC_PROFILE_RATE-th allocation done by devs_any_try_alloc() from
+// bytecode records the function and PC of ctx->curr_fn, as long as the allocated object
+// is alive, and up to DEVS_ALLOC_PROFILE_SIZE objects at a time (a random subset of all
+// samples, once there are more).
+#ifndef DEVS_ALLOC_PROFILE
+#define DEVS_ALLOC_PROFILE 0
+#endif
+
+#ifndef DEVS_ALLOC_PROFILE_RATE
+#define DEVS_ALLOC_PROFILE_RATE 16
+#endif
+
+#ifndef DEVS_ALLOC_PROFILE_SIZE
+#define DEVS_ALLOC_PROFILE_SIZE 64
+#endif
+
 #define DEVS_GC_TAG_MASK_PENDING 0x80
 #define DEVS_GC_TAG_MASK_SCANNED 0x20
 #define DEVS_GC_TAG_MASK_PINNED 0x40
-#define DEVS_GC_TAG_MASK 0xf // 0x1f should be possible
+#define DEVS_GC_TAG_MASK_REMEMBERED 0x10 // old object in the remembered set
+#define DEVS_GC_TAG_MASK 0xf
 
 // update devs_gc_tag_name() when adding/reordering
 #define DEVS_GC_TAG_NULL 0x0
@@ -259,6 +333,7 @@ void devs_gc_destroy(devs_gc_t *gc);
 #define DEVS_GC_TAG_PACKET 0xB
 #define DEVS_GC_TAG_STRING_JMP 0xC
 #define DEVS_GC_TAG_IMAGE 0xD
+#define DEVS_GC_TAG_SHAPE 0xE
 #define DEVS_GC_TAG_BUILTIN_PROTO DEVS_GC_TAG_MASK // these are not in GC heap!
 #define DEVS_GC_TAG_FINAL (DEVS_GC_TAG_MASK | DEVS_GC_TAG_MASK_PINNED)
 
@@ -270,6 +345,38 @@ static inline int devs_gc_tag(const void *ptr) {
 void devs_gc_obj_check(devs_ctx_t *ctx, const void *ptr);
 int devs_dump_heap(devs_ctx_t *ctx, int off, int cnt);
 
+#if DEVS_GC_GENERATIONAL || DEVS_GC_INCREMENTAL
+// Has to be called after storing a pointer into an existing GC object, once the function
+// doing the store will not allocate anymore. Stores into activations on fiber stacks,
+// the_stack and globals don't need it.
+void devs_gc_write_barrier(devs_ctx_t *ctx, const void *obj);
+#else
+static inline void devs_gc_write_barrier(devs_ctx_t *ctx, const void *obj) {}
+#endif
+
+#if DEVS_GC_INCREMENTAL || DEVS_GC_COMPACT
+// does a bounded amount of collection work (or compaction); called between fiber runs,
+// when no native code holds pointers to unpinned GC objects
+void devs_gc_step(devs_gc_t *gc);
+#else
+static inline void devs_gc_step(devs_gc_t *gc) {}
+#endif
+
+#if DEVS_ALLOC_PROFILE
+typedef struct {
+    uint16_t fn_idx;
+    devs_pc_t pc;
+    uint32_t count; // live sampled objects allocated here
+    uint32_t bytes; // their total size
+} devs_alloc_site_t;
+
+// Runs a full collection, and returns the number of allocation sites with live sampled objects;
+// `*sites` is valid until the next call. `*num_dropped` is the number of samples that were not
+// kept, or were evicted, because DEVS_ALLOC_PROFILE_SIZE objects were already sampled.
+unsigned devs_alloc_profile_snapshot(devs_ctx_t *ctx, const devs_alloc_site_t **sites,
+                                     uint32_t *num_dropped);
+#endif
+
 static inline bool devs_is_map(const void *ptr) {
     int t = devs_gc_tag(ptr);
     return t == DEVS_GC_TAG_MAP || t == DEVS_GC_TAG_HALF_STATIC_MAP;
@@ -281,8 +388,15 @@ static inline bool devs_is_proto(const void *ptr) {
 
 const char *devs_gc_tag_name(unsigned tag);
 
+// like devs_any_try_alloc(), but doesn't panic on OOM
+void *jd_gc_any_try_alloc(devs_gc_t *gc, unsigned tag, uint32_t size);
 void jd_gc_unpin(devs_gc_t *gc, void *ptr);
 void jd_gc_free(devs_gc_t *gc, void *ptr);
+// Frees an object nothing refers to (not even the remembered set), unless a collection is in
+// progress; returns false if the object was left to the GC.
+bool devs_gc_try_free(devs_gc_t *gc, void *obj);
+// total size of the heap, in bytes
+unsigned devs_gc_heap_size(devs_gc_t *gc);
 #if JD_64
 void *devs_gc_base_addr(devs_gc_t *gc);
 #else
@@ -6,6 +6,12 @@ typedef struct {
     uint16_t builtin_idx;       // 0 ... DEVS_BUILTIN_OBJECT___MAX, DEVS_FIRST_BUILTIN_FUNCTION ...
 } devs_builtin_proto_entry_t;
 
+// perfect hash of entries: entries[slots[builtin_string_id % size]], 0xff when empty
+typedef struct {
+    const uint8_t *slots;
+    uint8_t size;
+} devs_builtin_proto_hash_t;
+
 typedef void (*devs_method_cb_t)(devs_ctx_t *ctx);
 typedef value_t (*devs_prop_cb_t)(devs_ctx_t *ctx, value_t self);
 
@@ -27,3 +33,9 @@ typedef struct {
 
 extern uint16_t devs_num_builtin_functions;
 extern const devs_builtin_function_t devs_builtin_functions[];
+
+// see devs_builtin_string_lookup()
+extern const uint16_t devs_builtin_string_hash_buckets;
+extern const uint16_t devs_builtin_string_hash_size;
+extern const uint8_t devs_builtin_string_disp[];
+extern const uint16_t devs_builtin_string_slots[];
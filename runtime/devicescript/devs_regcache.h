@@ -10,13 +10,42 @@ typedef struct devs_regcache_entry {
     } value;
     uint8_t resp_size;
     uint16_t argument;
+    // links are 1 + index of the entry, 0 for none
+    uint8_t next_in_bucket; // also the free list
+    uint8_t next_by_role;
+    uint8_t lru_prev;
+    uint8_t lru_next;
 } devs_regcache_entry_t;
 
-#define DEVS_REGCACHE_NUM_ENTRIES 20
+// number of cached register values; at most 255
+#ifndef DEVS_REGCACHE_NUM_ENTRIES
+#define DEVS_REGCACHE_NUM_ENTRIES 32
+#endif
+// buckets in the lookup by role, command and argument; power of 2
+#ifndef DEVS_REGCACHE_HASH_SIZE
+#define DEVS_REGCACHE_HASH_SIZE 32
+#endif
+// buckets in the lookup by role only; power of 2
+#ifndef DEVS_REGCACHE_ROLE_HASH_SIZE
+#define DEVS_REGCACHE_ROLE_HASH_SIZE 8
+#endif
+
+#if DEVS_REGCACHE_NUM_ENTRIES > 255
+#error "DEVS_REGCACHE_NUM_ENTRIES too large"
+#endif
 
 typedef struct devs_regcache {
     devs_regcache_entry_t entries[DEVS_REGCACHE_NUM_ENTRIES];
-    uint16_t latest_idx;
+    uint8_t buckets[DEVS_REGCACHE_HASH_SIZE];
+    uint8_t by_role[DEVS_REGCACHE_ROLE_HASH_SIZE];
+    uint8_t lru_first; // most recently used
+    uint8_t lru_last;
+    uint8_t free_list;
+    uint8_t num_used; // entries past this were never allocated
+    // for diagnostics
+    uint32_t num_hits;   // register reads answered from the cache
+    uint32_t num_misses; // register reads that had to go to the bus
+    uint32_t num_evictions;
 } devs_regcache_t;
 
 static inline void *devs_regcache_data(devs_regcache_entry_t *q) {
@@ -28,7 +57,8 @@ devs_regcache_entry_t *devs_regcache_mark_used(devs_regcache_t *cache, devs_regc
 devs_regcache_entry_t *devs_regcache_lookup(devs_regcache_t *cache, unsigned role_idx,
                                             unsigned service_command, unsigned argument);
 devs_regcache_entry_t *devs_regcache_alloc(devs_regcache_t *cache, unsigned role_idx,
-                                           unsigned service_command, unsigned resp_size);
+                                           unsigned service_command, unsigned argument,
+                                           unsigned resp_size);
 void devs_regcache_age(devs_regcache_t *cache, unsigned role_idx, uint32_t min_time);
 void devs_regcache_free_role(devs_regcache_t *cache, unsigned role_idx);
 devs_regcache_entry_t *devs_regcache_next(devs_regcache_t *cache, unsigned role_idx,
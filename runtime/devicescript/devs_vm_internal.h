@@ -4,13 +4,284 @@
 #define DEVS_BUFFER_RW 1
 #define DEVS_BUFFER_STRING_OK 2
 
+// use computed-goto dispatch in devs_vm_exec_opcodes() where the compiler supports it
+#ifndef DEVS_VM_THREADED_DISPATCH
+#if defined(__GNUC__) || defined(__clang__)
+#define DEVS_VM_THREADED_DISPATCH 1
+#else
+#define DEVS_VM_THREADED_DISPATCH 0
+#endif
+#endif
+
+// execute int-only add/sub/compare (incl. fused ones) directly on the stack, falling back to
+// the regular handlers for other operands
+#ifndef DEVS_VM_INT_FAST_PATH
+#define DEVS_VM_INT_FAST_PATH 1
+#endif
+
+// internal opcodes, only found in decoded functions with DEVS_QUICKEN; the original opcode is kept
+// in devs_decoded_op_t.orig_op
+#define DEVS_QOP_INT 0x7e     // operands were ints so far
+#define DEVS_QOP_GENERIC 0x7f // operands weren't always ints; just run the handler
+
+// count executions of every opcode, by kinds of its first two operands;
+// see devs_vm_dump_op_stats()
+#ifndef DEVS_OP_STATS
+#define DEVS_OP_STATS 0
+#endif
+
+// with DEVS_OP_STATS, also sum up the time spent in every opcode (including dispatch), using
+// this timestamp counter
+#if !defined(DEVS_OP_STATS_CYCLES) && (defined(__x86_64__) || defined(__i386__))
+#define DEVS_OP_STATS_CYCLES() __builtin_ia32_rdtsc()
+#endif
+
 value_t devs_vm_pop_arg(devs_ctx_t *ctx);
 uint32_t devs_vm_pop_arg_u32(devs_ctx_t *ctx);
 int32_t devs_vm_pop_arg_i32(devs_ctx_t *ctx);
 double devs_vm_pop_arg_f64(devs_ctx_t *ctx);
 value_t devs_vm_pop_arg_buffer(devs_ctx_t *ctx, int flags);
 
+#if DEVS_VM_THREADED_DISPATCH
+// in vm_ops.c, where the handlers can be inlined into it
+unsigned devs_vm_exec_threaded(devs_ctx_t *ctx, unsigned maxsteps, unsigned preempt_at);
+#else
 extern const void *const devs_vm_op_handlers[];
 
 typedef void (*devs_vm_stmt_handler_t)(devs_activation_t *frame, devs_ctx_t *ctx);
 typedef value_t (*devs_vm_expr_handler_t)(devs_activation_t *frame, devs_ctx_t *ctx);
+#endif
+
+#if DEVS_OP_STATS
+void devs_vm_op_stats_enter(devs_ctx_t *ctx, unsigned op);
+#else
+static inline void devs_vm_op_stats_enter(devs_ctx_t *ctx, unsigned op) {}
+#endif
+
+// the rest is used by the interpreter loops
+
+static inline uint8_t devs_vm_fetch_byte(devs_activation_t *frame, devs_ctx_t *ctx) {
+    if (frame->pc < frame->maxpc)
+        return ctx->img.data[frame->pc++];
+    devs_invalid_program(ctx, 60100);
+    return 0;
+}
+
+static inline int32_t devs_vm_fetch_int(devs_activation_t *frame, devs_ctx_t *ctx) {
+    uint8_t v = devs_vm_fetch_byte(frame, ctx);
+    if (v < DEVS_FIRST_MULTIBYTE_INT)
+        return v;
+
+    int32_t r = 0;
+    bool n = !!(v & 4);
+    int len = (v & 3) + 1;
+    for (int i = 0; i < len; ++i) {
+        uint8_t b = devs_vm_fetch_byte(frame, ctx);
+        r <<= 8;
+        r |= b;
+    }
+
+    return n ? -r : r;
+}
+
+static inline void devs_vm_push(devs_ctx_t *ctx, value_t v) {
+    if (ctx->stack_top >= DEVS_MAX_STACK_DEPTH)
+        devs_invalid_program(ctx, 60101);
+    else
+        ctx->the_stack[ctx->stack_top++] = v;
+}
+
+static inline devs_decoded_op_t *devs_vm_fetch_decoded(devs_ctx_t *ctx,
+                                                        devs_activation_t *frame) {
+    devs_fn_cache_t *c = ctx->fn_cache;
+    if (!c)
+        return NULL;
+    const devs_function_desc_t *func = frame->func;
+    if (c->last_func != func) {
+        c->last_func = func;
+        c->last_ops = c->entries[func - devs_img_get_function(ctx->img, 0)].ops;
+    }
+    if (!c->last_ops)
+        return NULL;
+    unsigned off = frame->pc - func->start;
+    if (off >= func->length)
+        return NULL;
+    devs_decoded_op_t *d = &c->last_ops[off];
+    return d->size ? d : NULL;
+}
+
+#if DEVS_VM_INT_FAST_PATH
+static inline bool devs_vm_is_int_fast_op(uint8_t op) {
+    switch (op) {
+    case DEVS_EXPR2_ADD:
+    case DEVS_EXPR2_SUB:
+    case DEVS_EXPR2_LT:
+    case DEVS_EXPR2_LE:
+    case DEVS_EXPR2_EQ:
+    case DEVS_EXPR2_NE:
+    case DEVS_STMTx2_ADD_STORE_LOCAL:
+    case DEVS_STMTx2_JMP_LT_Z:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Executes op (one of devs_vm_is_int_fast_op()) in place on the stack (and the local slot or
+// pc of frame), when both operands are tagged ints.
+// Returns false, without touching anything, when the regular handler is needed: for other
+// operand types, on overflow, and on anything that might be an error.
+static inline bool devs_vm_exec_int_op(devs_ctx_t *ctx, devs_activation_t *frame, uint8_t op) {
+    unsigned top = ctx->stack_top;
+    if (top < 2)
+        return false;
+    value_t *args = &ctx->the_stack[top - 2];
+    if (!devs_is_tagged_int(args[0]) || !devs_is_tagged_int(args[1]))
+        return false;
+    int32_t a = args[0].val_int32, b = args[1].val_int32, r;
+
+    switch (op) {
+    case DEVS_EXPR2_ADD:
+        if (__builtin_sadd_overflow(a, b, &r))
+            return false;
+        args[0] = devs_value_from_int(r);
+        break;
+    case DEVS_EXPR2_SUB:
+        if (__builtin_ssub_overflow(a, b, &r))
+            return false;
+        args[0] = devs_value_from_int(r);
+        break;
+    case DEVS_EXPR2_LT:
+        args[0] = a < b ? devs_true : devs_false;
+        break;
+    case DEVS_EXPR2_LE:
+        args[0] = a <= b ? devs_true : devs_false;
+        break;
+    case DEVS_EXPR2_EQ:
+        args[0] = a == b ? devs_true : devs_false;
+        break;
+    case DEVS_EXPR2_NE:
+        args[0] = a != b ? devs_true : devs_false;
+        break;
+    case DEVS_STMTx2_ADD_STORE_LOCAL: {
+        unsigned off = ctx->literal_int;
+        if (top != 2 || off >= frame->func->num_slots || __builtin_sadd_overflow(a, b, &r))
+            return false;
+        frame->slots[off] = devs_value_from_int(r);
+        ctx->stack_top = 0;
+        return true;
+    }
+    case DEVS_STMTx2_JMP_LT_Z: {
+        int pc = ctx->jmp_pc + ctx->literal_int;
+        if (top != 2 || pc < (int)frame->func->start || pc >= frame->maxpc)
+            return false;
+        if (!(a < b))
+            frame->pc = pc;
+        ctx->stack_top = 0;
+        return true;
+    }
+    default:
+        return false;
+    }
+
+    ctx->stack_top = top - 1;
+    return true;
+}
+#endif
+
+#if DEVS_QUICKEN
+#if !DEVS_VM_INT_FAST_PATH
+#error "DEVS_QUICKEN requires DEVS_VM_INT_FAST_PATH"
+#endif
+
+// Called for decoded ops that are either DEVS_QOP_* or one of devs_vm_is_int_fast_op().
+// Returns true if the op was executed; otherwise the handler for d->orig_op needs to run.
+// The first execution picks DEVS_QOP_INT or DEVS_QOP_GENERIC; a DEVS_QOP_INT op that sees
+// other operands goes to DEVS_QOP_GENERIC for good.
+static inline bool devs_vm_quick_op(devs_ctx_t *ctx, devs_activation_t *frame,
+                                    devs_decoded_op_t *d) {
+    switch (d->op) {
+    case DEVS_QOP_INT:
+        if (devs_vm_exec_int_op(ctx, frame, d->orig_op))
+            return true;
+        d->op = DEVS_QOP_GENERIC;
+        return false;
+    case DEVS_QOP_GENERIC:
+        return false;
+    default:
+        d->orig_op = d->op;
+        if (devs_vm_exec_int_op(ctx, frame, d->op)) {
+            d->op = DEVS_QOP_INT;
+            return true;
+        }
+        d->op = DEVS_QOP_GENERIC;
+        return false;
+    }
+}
+#endif
+
+#if DEVS_DEFER_METHOD_BIND
+// the_stack[0] might hold a method that a field lookup left unbound (see devs_bind_stack0());
+// bind it now, unless op is a call (which takes ctx->stack0_this as 'this'),
+// or doesn't use the_stack[0]
+static inline void devs_vm_use_stack0(devs_ctx_t *ctx, uint8_t op) {
+    if (!ctx->stack0_unbound)
+        return;
+    uint8_t flags = DEVS_OP_PROPS[op];
+    if (flags & DEVS_BYTECODEFLAG_IS_STMT) {
+        if ((DEVS_STMT1_CALL0 <= op && op <= DEVS_STMT9_CALL8) || op == DEVS_STMT2_CALL_ARRAY)
+            return;
+    } else if ((flags & DEVS_BYTECODEFLAG_NUM_ARGS_MASK) < ctx->stack_top) {
+        return;
+    }
+    devs_bind_stack0(ctx);
+}
+#else
+static inline void devs_vm_use_stack0(devs_ctx_t *ctx, uint8_t op) {}
+#endif
+
+static inline unsigned devs_vm_brk_hash(unsigned pc) {
+    return pc & (DEVS_BRK_HASH_SIZE - 1);
+}
+
+static inline bool devs_vm_chk_brk(devs_ctx_t *ctx, devs_activation_t *frame) {
+    if (ctx->dbg_en) {
+        if (ctx->ignore_brk) {
+            ctx->ignore_brk = false;
+            return false;
+        }
+
+        devs_pc_t pc = frame->pc;
+        unsigned i = ctx->brk_jump_tbl[devs_vm_brk_hash(pc)];
+
+        if (i) {
+            devs_brk_t *l = ctx->brk_list;
+            for (--i; pc >= l[i].pc; ++i) {
+                if (pc == l[i].pc) {
+                    if (l[i].flags & DEVS_BRK_FLAG_STEP) {
+                        // DMESG("chk step %d %p %p", pc, frame, ctx->step_fn);
+                        if (frame == ctx->step_fn) {
+                            devs_vm_suspend(ctx, JD_DEVS_DBG_SUSPENSION_TYPE_STEP);
+                            return true;
+                        } else {
+                            continue;
+                        }
+                    } else {
+                        devs_vm_suspend(ctx, JD_DEVS_DBG_SUSPENSION_TYPE_BREAKPOINT);
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+// between statements nothing is kept on the stack, so the fiber can be resumed later
+static bool devs_vm_preempt(devs_ctx_t *ctx, unsigned maxsteps, unsigned preempt_at) {
+    if (maxsteps >= preempt_at || ctx->stack_top || ctx->in_throw || !ctx->curr_fiber)
+        return false;
+    devs_fiber_preempt(ctx);
+    return true;
+}
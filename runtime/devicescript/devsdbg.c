@@ -7,6 +7,18 @@
 #define LOG_TAG "dbg"
 #include "devs_logging.h"
 
+// not in the debugger spec yet; responds with devs_gc_stats_t
+#ifndef JD_DEVS_DBG_CMD_READ_GC_STATS
+#define JD_DEVS_DBG_CMD_READ_GC_STATS 0xa0
+#endif
+
+// not in the debugger spec yet; streams devs_alloc_site_t, when built with DEVS_ALLOC_PROFILE;
+// the last entry has fn_idx == ALLOC_SITES_DROPPED, and the number of dropped samples in `count`
+#ifndef JD_DEVS_DBG_CMD_READ_ALLOC_SITES
+#define JD_DEVS_DBG_CMD_READ_ALLOC_SITES 0xa1
+#endif
+#define ALLOC_SITES_DROPPED 0xffff
+
 struct srv_state {
     SRV_COMMON;
     uint8_t enabled;
@@ -612,6 +624,9 @@ void devsdbg_handle_packet(srv_t *state, jd_packet_t *pkt) {
         case JD_DEVS_DBG_CMD_READ_STACK:
         case JD_DEVS_DBG_CMD_READ_INDEXED_VALUES:
         case JD_DEVS_DBG_CMD_READ_NAMED_VALUES:
+#if DEVS_ALLOC_PROFILE
+        case JD_DEVS_DBG_CMD_READ_ALLOC_SITES:
+#endif
             send_empty(cmd);
             return;
 
@@ -686,6 +701,34 @@ void devsdbg_handle_packet(srv_t *state, jd_packet_t *pkt) {
         read_value(cmd);
         break;
 
+    case JD_DEVS_DBG_CMD_READ_GC_STATS: {
+        devs_gc_stats_t stats = {0};
+        if (ctx)
+            devs_get_gc_stats(ctx, &stats);
+        jd_send(pkt->service_index, pkt->service_command, &stats, sizeof(stats));
+        break;
+    }
+
+#if DEVS_ALLOC_PROFILE
+    case JD_DEVS_DBG_CMD_READ_ALLOC_SITES: {
+        const devs_alloc_site_t *sites;
+        uint32_t num_dropped;
+        unsigned num_sites = devs_alloc_profile_snapshot(ctx, &sites, &num_dropped);
+        devs_alloc_site_t *data =
+            devsdbg_open_results_pipe(cmd, sizeof(devs_alloc_site_t), num_sites + 1);
+        if (data) {
+            for (unsigned i = 0; i < num_sites; ++i) {
+                data[i] = sites[i];
+                data[i].fn_idx = map_fn_idx(sites[i].fn_idx);
+            }
+            memset(&data[num_sites], 0, sizeof(devs_alloc_site_t));
+            data[num_sites].fn_idx = ALLOC_SITES_DROPPED;
+            data[num_sites].count = num_dropped;
+        }
+        break;
+    }
+#endif
+
     case JD_DEVS_DBG_CMD_CLEAR_BREAKPOINTS:
         for (unsigned i = 0; i < pkt->service_size; i += 4)
             devs_vm_clear_breakpoint(ctx, *((uint32_t *)(pkt->data + i)));
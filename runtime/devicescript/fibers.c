@@ -22,6 +22,60 @@ static void devs_fiber_activate(devs_fiber_t *fiber, devs_activation_t *act) {
     }
 }
 
+// words after the header, for locals and try frames
+static unsigned act_words(const devs_function_desc_t *func) {
+    return (sizeof(value_t) * func->num_slots + sizeof(devs_pc_t) * func->num_try_frames +
+            sizeof(value_t) - 1) /
+           sizeof(value_t);
+}
+
+static devs_activation_t *act_alloc(devs_ctx_t *ctx, const devs_function_desc_t *func) {
+    unsigned words = act_words(func);
+#if DEVS_ACT_POOL_DEPTH
+    if (words <= DEVS_ACT_POOL_MAX_WORDS && ctx->act_pool[words]) {
+        devs_activation_t *act = ctx->act_pool[words];
+        ctx->act_pool[words] = act->caller;
+        ctx->act_pool_len[words]--;
+        return act;
+    }
+#endif
+    return devs_any_try_alloc(ctx, DEVS_GC_TAG_ACTIVATION,
+                              sizeof(devs_activation_t) + sizeof(value_t) * words);
+}
+
+static bool act_no_closures(devs_activation_t *act) {
+    // checked by devs_verify(); older compilers don't set it
+    return (act->func->flags & DEVS_FUNCTIONFLAG_NO_CLOSURES) != 0;
+}
+
+// Keeps a frame that returned for reuse, unless something may still refer to it. Pooled frames
+// are GC roots, so they are cleared here, so as not to keep their locals alive. Frames that
+// can't be captured and don't fit in the pool are given back to the heap right away.
+static void act_release(devs_ctx_t *ctx, devs_activation_t *act) {
+    bool no_closures = act_no_closures(act);
+    // the debugger holds frames by reference, and closures hold the frame they were made in
+    if (ctx->dbg_en || (!no_closures && act->captured)) {
+        // slots are stored without barriers, as every collection rescans frames on the fiber;
+        // the frame now outlives the call, so it may be old and point to young objects
+        devs_gc_write_barrier(ctx, act);
+        return;
+    }
+#if DEVS_ACT_POOL_DEPTH
+    unsigned words = act_words(act->func);
+    if (words <= DEVS_ACT_POOL_MAX_WORDS && ctx->act_pool_len[words] < DEVS_ACT_POOL_DEPTH) {
+        memset(act->slots, 0, sizeof(value_t) * words);
+        act->maxpc = 0;
+        act->closure = NULL;
+        act->caller = ctx->act_pool[words];
+        ctx->act_pool[words] = act;
+        ctx->act_pool_len[words]++;
+        return;
+    }
+#endif
+    if (no_closures)
+        devs_gc_try_free(ctx->gc, act);
+}
+
 STATIC_ASSERT(DEVS_MAX_CALL_DEPTH + 10 < 1ULL << (sizeof(((devs_fiber_t *)NULL)->stack_depth) * 8));
 
 int devs_fiber_call_function(devs_fiber_t *fiber, unsigned numparams, devs_array_t *rest) {
@@ -33,6 +87,12 @@ int devs_fiber_call_function(devs_fiber_t *fiber, unsigned numparams, devs_array
     value_t fn = *argp;
     devs_activation_t *closure;
     int fidx = devs_get_fnidx(ctx, fn, argp, &closure);
+    if (ctx->stack0_unbound) {
+        // obj.method(...) call, see DEVS_DEFER_METHOD_BIND
+        ctx->stack0_unbound = 0;
+        *argp = ctx->stack0_this;
+        ctx->stack0_this = devs_undefined;
+    }
     if (fidx < 0) {
         devs_throw_type_error(ctx, "%s called", devs_show_value(ctx, fn));
         return -1;
@@ -82,10 +142,7 @@ int devs_fiber_call_function(devs_fiber_t *fiber, unsigned numparams, devs_array
     fiber->stack_depth++;
 
     const devs_function_desc_t *func = devs_img_get_function(ctx->img, fidx);
-    devs_activation_t *callee =
-        devs_any_try_alloc(ctx, DEVS_GC_TAG_ACTIVATION,
-                           sizeof(devs_activation_t) + sizeof(value_t) * func->num_slots +
-                               sizeof(devs_pc_t) * func->num_try_frames);
+    devs_activation_t *callee = act_alloc(ctx, func);
 
     if (callee == NULL)
         return -2;
@@ -149,9 +206,14 @@ int devs_fiber_call_function(devs_fiber_t *fiber, unsigned numparams, devs_array
     if ((func->flags & DEVS_FUNCTIONFLAG_IS_CTOR) && devs_is_undefined(callee->slots[0])) {
         devs_map_t *m = devs_map_try_alloc(ctx, devs_get_prototype_field(ctx, fn));
         callee->slots[0] = devs_value_from_gc_obj(ctx, m);
+        // objects of the same class will share key tables
+        if (m)
+            devs_map_use_shape(ctx, m);
         // devs_log_value(ctx, "ctor", callee->slots[0]);
     }
 
+    devs_fn_cache_enter(ctx, fidx);
+
     if (ctx->dbg_en && ctx->step_fn == caller && (ctx->step_flags & DEVS_CTX_STEP_IN)) {
         devs_vm_suspend(ctx, JD_DEVS_DBG_SUSPENSION_TYPE_STEP);
     }
@@ -159,8 +221,160 @@ int devs_fiber_call_function(devs_fiber_t *fiber, unsigned numparams, devs_array
     return 0;
 }
 
+// Fibers with wake_time set are kept in a binary heap in ctx->sleeping, with the one to wake up
+// first on top; the ones due at the same time run in the order they were started.
+static bool wakes_before(devs_fiber_t *a, devs_fiber_t *b) {
+    if (a->wake_time != b->wake_time)
+        return a->wake_time < b->wake_time;
+    return a->handle_tag < b->handle_tag;
+}
+
+static void sleeping_put(devs_ctx_t *ctx, unsigned i, devs_fiber_t *fiber) {
+    ctx->sleeping[i] = fiber;
+    fiber->sleep_idx = i + 1;
+}
+
+// moves ctx->sleeping[i] up or down to where it belongs
+static void sleeping_sift(devs_ctx_t *ctx, unsigned i) {
+    devs_fiber_t **heap = ctx->sleeping;
+    devs_fiber_t *fiber = heap[i];
+    while (i > 0) {
+        unsigned parent = (i - 1) / 2;
+        if (!wakes_before(fiber, heap[parent]))
+            break;
+        sleeping_put(ctx, i, heap[parent]);
+        i = parent;
+    }
+    for (;;) {
+        unsigned child = 2 * i + 1;
+        if (child >= ctx->num_sleeping)
+            break;
+        if (child + 1 < ctx->num_sleeping && wakes_before(heap[child + 1], heap[child]))
+            child++;
+        if (!wakes_before(heap[child], fiber))
+            break;
+        sleeping_put(ctx, i, heap[child]);
+        i = child;
+    }
+    sleeping_put(ctx, i, fiber);
+}
+
+static void sleeping_remove(devs_ctx_t *ctx, devs_fiber_t *fiber) {
+    unsigned i = fiber->sleep_idx - 1;
+    fiber->sleep_idx = 0;
+    devs_fiber_t *last = ctx->sleeping[--ctx->num_sleeping];
+    if (last != fiber) {
+        ctx->sleeping[i] = last;
+        sleeping_sift(ctx, i);
+    }
+}
+
+// there is room in the heap for every fiber, so that setting wake time never allocates
+static bool sleeping_reserve(devs_ctx_t *ctx) {
+    if (ctx->num_fibers < ctx->sleeping_size)
+        return true;
+    unsigned size = ctx->sleeping_size ? ctx->sleeping_size * 2 : 8;
+    if (size > 0xffff)
+        return false;
+    devs_fiber_t **heap = devs_try_alloc(ctx, size * sizeof(devs_fiber_t *));
+    if (heap == NULL)
+        return false;
+    memcpy(heap, ctx->sleeping, ctx->num_sleeping * sizeof(devs_fiber_t *));
+    devs_free(ctx, ctx->sleeping);
+    ctx->sleeping = heap;
+    ctx->sleeping_size = size;
+    return true;
+}
+
 void devs_fiber_set_wake_time(devs_fiber_t *fiber, unsigned time) {
+    devs_ctx_t *ctx = fiber->ctx;
     fiber->wake_time = time;
+    if (fiber->sleep_idx) {
+        if (time)
+            sleeping_sift(ctx, fiber->sleep_idx - 1);
+        else
+            sleeping_remove(ctx, fiber);
+    } else if (time) {
+        JD_ASSERT(ctx->num_sleeping < ctx->sleeping_size);
+        ctx->sleeping[ctx->num_sleeping++] = fiber;
+        sleeping_sift(ctx, ctx->num_sleeping - 1);
+    }
+}
+
+// the fiber is waiting for a register value, which is now in the cache
+void devs_fiber_role_wake(devs_fiber_t *fiber) {
+    devs_ctx_t *ctx = fiber->ctx;
+    fiber->role_wkp = 1;
+    if (fiber->ready)
+        return;
+    fiber->ready = 1;
+    fiber->next_ready = NULL;
+    if (ctx->ready_last)
+        ctx->ready_last->next_ready = fiber;
+    else
+        ctx->ready_first = fiber;
+    ctx->ready_last = fiber;
+}
+
+static devs_fiber_t *pop_ready(devs_ctx_t *ctx) {
+    while (ctx->ready_first) {
+        devs_fiber_t *fiber = ctx->ready_first;
+        ctx->ready_first = fiber->next_ready;
+        if (ctx->ready_first == NULL)
+            ctx->ready_last = NULL;
+        fiber->ready = 0;
+        fiber->next_ready = NULL;
+        if (fiber->role_wkp)
+            return fiber;
+    }
+    return NULL;
+}
+
+static void unlink_ready(devs_ctx_t *ctx, devs_fiber_t *fiber) {
+    devs_fiber_t *prev = NULL;
+    for (devs_fiber_t *f = ctx->ready_first; f; prev = f, f = f->next_ready) {
+        if (f == fiber) {
+            if (prev)
+                prev->next_ready = fiber->next_ready;
+            else
+                ctx->ready_first = fiber->next_ready;
+            if (ctx->ready_last == fiber)
+                ctx->ready_last = prev;
+            break;
+        }
+    }
+    fiber->ready = 0;
+}
+
+#define FIBER_HASH(v) ((v) & (DEVS_FIBER_HASH_SIZE - 1))
+
+// fibers are added at the end of their bucket, so lookups find the one started first
+static void link_fiber(devs_ctx_t *ctx, devs_fiber_t *fiber) {
+    devs_fiber_t **p = &ctx->fibers_by_tag[FIBER_HASH(fiber->handle_tag)];
+    while (*p)
+        p = &(*p)->next_by_tag;
+    *p = fiber;
+    p = &ctx->fibers_by_fidx[FIBER_HASH(fiber->bottom_function_idx)];
+    while (*p)
+        p = &(*p)->next_by_fidx;
+    *p = fiber;
+    ctx->num_fibers++;
+}
+
+static void unlink_fiber(devs_ctx_t *ctx, devs_fiber_t *fiber) {
+    devs_fiber_t **p = &ctx->fibers_by_tag[FIBER_HASH(fiber->handle_tag)];
+    while (*p != fiber)
+        p = &(*p)->next_by_tag;
+    *p = fiber->next_by_tag;
+    p = &ctx->fibers_by_fidx[FIBER_HASH(fiber->bottom_function_idx)];
+    while (*p != fiber)
+        p = &(*p)->next_by_fidx;
+    *p = fiber->next_by_fidx;
+    ctx->num_fibers--;
+    if (fiber->sleep_idx)
+        sleeping_remove(ctx, fiber);
+    if (fiber->ready)
+        unlink_ready(ctx, fiber);
 }
 
 void devs_fiber_sleep(devs_fiber_t *fiber, unsigned time) {
@@ -175,10 +389,20 @@ void devs_fiber_sleep(devs_fiber_t *fiber, unsigned time) {
     devs_fiber_yield(fiber->ctx);
 }
 
+void devs_fiber_preempt(devs_ctx_t *ctx) {
+    // due right away, but after the fibers that were due before now
+    ctx->preempted = 1;
+    devs_fiber_set_wake_time(ctx->curr_fiber, devs_now(ctx));
+    devs_fiber_yield(ctx);
+}
+
 void devs_fiber_await(devs_fiber_t *fib, uint8_t *awaiting) {
     *awaiting = 0;
     fib->pkt_kind = DEVS_PKT_KIND_AWAITING;
     fib->pkt_data.awaiting = awaiting;
+    // unlinked in devs_jd_clear_pkt_kind()
+    fib->next_awaiting = fib->ctx->fibers_awaiting;
+    fib->ctx->fibers_awaiting = fib;
     devs_fiber_sleep(fib, 0xffffffff);
 }
 
@@ -199,6 +423,7 @@ static void free_fiber(devs_fiber_t *fiber) {
         JD_ASSERT(f != NULL);
         f->next = fiber->next;
     }
+    unlink_fiber(ctx, fiber);
     devs_free(ctx, fiber);
 }
 
@@ -217,6 +442,7 @@ void devs_fiber_return_from_call(devs_fiber_t *fiber, devs_activation_t *act) {
         act->maxpc = 0; // protect against re-activation
         // act may survive as a closure past the caller intended lifetime
         act->caller = NULL;
+        act_release(ctx, act);
     } else {
         if (fiber->pending) {
             log_fiber_op(fiber, "re-run");
@@ -226,6 +452,7 @@ void devs_fiber_return_from_call(devs_fiber_t *fiber, devs_activation_t *act) {
             log_fiber_op(fiber, "free");
             devs_fiber_yield(ctx);
             free_fiber(fiber);
+            act_release(ctx, act);
             return;
         }
     }
@@ -239,6 +466,15 @@ void devs_fiber_free_all_fibers(devs_ctx_t *ctx) {
         devs_free(ctx, f);
         f = ctx->fibers;
     }
+    memset(ctx->fibers_by_tag, 0, sizeof(ctx->fibers_by_tag));
+    memset(ctx->fibers_by_fidx, 0, sizeof(ctx->fibers_by_fidx));
+    memset(ctx->fibers_waiting, 0, sizeof(ctx->fibers_waiting));
+    devs_free(ctx, ctx->sleeping);
+    ctx->sleeping = NULL;
+    ctx->num_sleeping = ctx->sleeping_size = 0;
+    ctx->num_fibers = 0;
+    ctx->fibers_awaiting = NULL;
+    ctx->ready_first = ctx->ready_last = NULL;
 }
 
 const char *devs_img_fun_name(devs_img_t img, unsigned fidx) {
@@ -256,14 +492,16 @@ const char *devs_img_fun_name(devs_img_t img, unsigned fidx) {
 }
 
 devs_fiber_t *devs_fiber_by_fidx(devs_ctx_t *ctx, unsigned fidx) {
-    for (devs_fiber_t *fiber = ctx->fibers; fiber; fiber = fiber->next)
+    for (devs_fiber_t *fiber = ctx->fibers_by_fidx[FIBER_HASH(fidx)]; fiber;
+         fiber = fiber->next_by_fidx)
         if (fiber->bottom_function_idx == fidx)
             return fiber;
     return NULL;
 }
 
 devs_fiber_t *devs_fiber_by_tag(devs_ctx_t *ctx, unsigned tag) {
-    for (devs_fiber_t *fiber = ctx->fibers; fiber; fiber = fiber->next)
+    for (devs_fiber_t *fiber = ctx->fibers_by_tag[FIBER_HASH(tag)]; fiber;
+         fiber = fiber->next_by_tag)
         if (fiber->handle_tag == tag)
             return fiber;
     return NULL;
@@ -301,12 +539,15 @@ devs_fiber_t *devs_fiber_start(devs_ctx_t *ctx, unsigned numargs, unsigned op) {
         }
     }
 
+    if (!sleeping_reserve(ctx))
+        return NULL;
     fiber = devs_try_alloc(ctx, sizeof(*fiber));
     if (fiber == NULL)
         return NULL;
     fiber->ctx = ctx;
     fiber->bottom_function_idx = fidx;
     fiber->handle_tag = ++ctx->fiber_handle_tag;
+    fiber->quantum = DEVS_FIBER_QUANTUM;
 
     log_fiber_op(fiber, "start");
 
@@ -320,6 +561,7 @@ devs_fiber_t *devs_fiber_start(devs_ctx_t *ctx, unsigned numargs, unsigned op) {
     } else {
         ctx->fibers = fiber;
     }
+    link_fiber(ctx, fiber);
 
     devs_fiber_call_function(fiber, numargs, NULL);
 
@@ -330,6 +572,10 @@ devs_fiber_t *devs_fiber_start(devs_ctx_t *ctx, unsigned numargs, unsigned op) {
 
 void devs_fiber_termiante(devs_fiber_t *f) {
     log_fiber_op(f, "terminate");
+    // closures may still refer to the frames; see act_release()
+    for (devs_activation_t *act = f->activation; act; act = act->caller)
+        if (f->ctx->dbg_en || !act_no_closures(act))
+            devs_gc_write_barrier(f->ctx, act);
     if (f->ctx->curr_fiber == f)
         devs_fiber_yield(f->ctx);
     free_fiber(f);
@@ -365,7 +611,19 @@ void devs_fiber_run(devs_fiber_t *fiber) {
         cb(ctx, data);
     }
 
-    devs_vm_exec_opcodes(ctx);
+    unsigned tag = fiber->handle_tag;
+    uint32_t busy = fiber->busy_steps;
+    uint64_t t0 = tim_get_micros();
+    ctx->preempted = 0;
+    unsigned steps = devs_vm_exec_opcodes(ctx, DEVS_MAX_STEPS - busy);
+
+    // the fiber may have finished
+    fiber = devs_fiber_by_tag(ctx, tag);
+    if (fiber) {
+        fiber->num_steps += steps;
+        fiber->run_time += tim_get_micros() - t0;
+        fiber->busy_steps = ctx->preempted ? busy + steps : 0;
+    }
 }
 
 void devs_panic(devs_ctx_t *ctx, unsigned code) {
@@ -431,14 +689,12 @@ unsigned devs_fiber_get_max_sleep(devs_ctx_t *ctx) {
     int min_ms = 100;
     uint32_t now_ = devs_now(ctx);
 
-    for (devs_fiber_t *fiber = ctx->fibers; fiber; fiber = fiber->next) {
-        if (fiber->wake_time) {
-            int d = fiber->wake_time - now_;
-            if (d < 0)
-                d = 0;
-            if (d < min_ms)
-                min_ms = d;
-        }
+    if (ctx->num_sleeping) {
+        int d = ctx->sleeping[0]->wake_time - now_;
+        if (d < 0)
+            d = 0;
+        if (d < min_ms)
+            min_ms = d;
     }
     return min_ms * 1000;
 }
@@ -447,21 +703,21 @@ static int devs_fiber_wake_some(devs_ctx_t *ctx) {
     if (devs_is_suspended(ctx))
         return 0;
     uint32_t now_ = devs_now(ctx);
-    devs_fiber_t *fibmin = NULL;
-
-    for (devs_fiber_t *fiber = ctx->fibers; fiber; fiber = fiber->next) {
-        if (fiber->role_wkp ||
-            (fiber->pkt_kind == DEVS_PKT_KIND_AWAITING && *fiber->pkt_data.awaiting)) {
-            fibmin = fiber;
-            break;
-        }
+    devs_fiber_t *fibmin = pop_ready(ctx);
 
-        if (fiber->wake_time && fiber->wake_time <= now_) {
-            if (fibmin == NULL || fibmin->wake_time > fiber->wake_time)
+    // awaits are completed outside of the VM, so there is nothing to queue these on
+    if (!fibmin) {
+        for (devs_fiber_t *fiber = ctx->fibers_awaiting; fiber; fiber = fiber->next_awaiting) {
+            if (*fiber->pkt_data.awaiting) {
                 fibmin = fiber;
+                break;
+            }
         }
     }
 
+    if (!fibmin && ctx->num_sleeping && ctx->sleeping[0]->wake_time <= now_)
+        fibmin = ctx->sleeping[0];
+
     if (!fibmin)
         return 0;
 
@@ -481,9 +737,13 @@ static void devs_print_warnings(devs_ctx_t *ctx) {
 
 void devs_fiber_poke(devs_ctx_t *ctx) {
     devs_fiber_sync_now(ctx);
-    while (devs_fiber_wake_some(ctx))
+    // after a preemption, let the main loop process packets before running more
+    ctx->preempted = 0;
+    while (!ctx->preempted && devs_fiber_wake_some(ctx))
         ;
 
+    devs_gc_step(ctx->gc);
+
     if (devs_now(ctx) > ctx->last_warning + 5 * 1024) {
         ctx->last_warning = devs_now(ctx);
         devs_print_warnings(ctx);
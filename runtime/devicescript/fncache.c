@@ -0,0 +1,167 @@
+#include "devs_internal.h"
+
+#define LOG_TAG "fncache"
+#include "devs_logging.h"
+
+// Decoded form of hot functions: one entry per byte of the function body,
+// with only instruction starts filled in (size != 0).
+// Anything the decoder is not sure about is left as size == 0, which makes
+// the VM use the regular fetch path (and report any errors from there).
+// With DEVS_QUICKEN, the VM also rewrites some of the decoded ops in place
+// (see devs_vm_quick_op()).
+// Breakpoints are checked by pc before the decoded op is looked up, so they work the same way
+// in decoded functions.
+
+// no devs_oom() here - the cache is optional
+static void *try_alloc(devs_ctx_t *ctx, unsigned size) {
+    uintptr_t *r = jd_gc_any_try_alloc(ctx->gc, DEVS_GC_TAG_MASK_PINNED | DEVS_GC_TAG_BYTES,
+                                       size + JD_PTRSIZE);
+    return r ? r + 1 : NULL;
+}
+
+static devs_fn_cache_t *get_cache(devs_ctx_t *ctx) {
+    if (ctx->fn_cache == NULL) {
+        unsigned num_fn = devs_img_num_functions(ctx->img);
+        ctx->fn_cache =
+            try_alloc(ctx, sizeof(devs_fn_cache_t) + num_fn * sizeof(devs_fn_cache_entry_t));
+        if (ctx->fn_cache) {
+            ctx->fn_cache->num_functions = num_fn;
+            ctx->fn_cache->max_bytes = devs_gc_heap_size(ctx->gc) / DEVS_FN_CACHE_HEAP_SHARE;
+            if (ctx->fn_cache->max_bytes > DEVS_FN_CACHE_MAX_BYTES)
+                ctx->fn_cache->max_bytes = DEVS_FN_CACHE_MAX_BYTES;
+        }
+    }
+    return ctx->fn_cache;
+}
+
+static int decode_int(const uint8_t *p, unsigned *pos, unsigned endp, int32_t *res) {
+    uint8_t v = p[(*pos)++];
+    if (v < DEVS_FIRST_MULTIBYTE_INT) {
+        *res = v;
+        return 0;
+    }
+
+    int32_t r = 0;
+    bool n = !!(v & 4);
+    unsigned len = (v & 3) + 1;
+    if (*pos + len > endp)
+        return -1;
+    for (unsigned i = 0; i < len; ++i) {
+        r <<= 8;
+        r |= p[(*pos)++];
+    }
+
+    *res = n ? -r : r;
+    return 0;
+}
+
+static void drop_ops(devs_ctx_t *ctx, unsigned fidx) {
+    devs_fn_cache_t *c = ctx->fn_cache;
+    devs_fn_cache_entry_t *e = &c->entries[fidx];
+    const devs_function_desc_t *func = devs_img_get_function(ctx->img, fidx);
+    LOGV("evict %s_F%d", devs_img_fun_name(ctx->img, fidx), fidx);
+    devs_free(ctx, e->ops);
+    e->ops = NULL;
+    c->used_bytes -= func->length * sizeof(devs_decoded_op_t);
+    // the VM might hold on to the ops
+    c->last_func = NULL;
+}
+
+// Make room for sz bytes by evicting functions called less than num_calls times.
+// All call counts are halved first, so that functions that were hot a while ago
+// eventually make room for the current ones.
+static bool evict(devs_ctx_t *ctx, unsigned sz, unsigned num_calls) {
+    devs_fn_cache_t *c = ctx->fn_cache;
+
+    for (unsigned i = 0; i < c->num_functions; ++i)
+        c->entries[i].num_calls >>= 1;
+
+    while (c->used_bytes + sz > c->max_bytes) {
+        int victim = -1;
+        for (unsigned i = 0; i < c->num_functions; ++i) {
+            devs_fn_cache_entry_t *e = &c->entries[i];
+            if (e->ops && e->num_calls < num_calls &&
+                (victim < 0 || e->num_calls < c->entries[victim].num_calls))
+                victim = i;
+        }
+        if (victim < 0)
+            return false;
+        drop_ops(ctx, victim);
+    }
+
+    return true;
+}
+
+static devs_decoded_op_t *decode_function(devs_ctx_t *ctx, const devs_function_desc_t *func,
+                                          unsigned num_calls) {
+    unsigned sz = func->length * sizeof(devs_decoded_op_t);
+    devs_fn_cache_t *c = ctx->fn_cache;
+
+    if (sz > c->max_bytes)
+        return NULL;
+    if (c->used_bytes + sz > c->max_bytes && !evict(ctx, sz, num_calls))
+        return NULL;
+
+    devs_decoded_op_t *ops = try_alloc(ctx, sz);
+    if (ops == NULL)
+        return NULL;
+    c->used_bytes += sz;
+
+    const uint8_t *code = ctx->img.data;
+    unsigned endp = func->start + func->length;
+    unsigned pc = func->start;
+
+    while (pc < endp) {
+        devs_decoded_op_t *d = &ops[pc - func->start];
+        unsigned startpc = pc;
+        uint8_t op = code[pc++];
+        if (op < DEVS_DIRECT_CONST_OP) {
+            if (op >= DEVS_OP_PAST_LAST)
+                continue;
+            if (DEVS_OP_PROPS[op] & DEVS_BYTECODEFLAG_TAKES_NUMBER) {
+                if (pc >= endp || decode_int(code, &pc, endp, &d->literal) != 0)
+                    break;
+            }
+        }
+        d->op = op;
+        d->size = pc - startpc;
+    }
+
+    return ops;
+}
+
+void devs_fn_cache_enter(devs_ctx_t *ctx, unsigned fidx) {
+    if (DEVS_FN_CACHE_THRESHOLD == 0)
+        return;
+
+    devs_fn_cache_t *c = get_cache(ctx);
+    if (!c || fidx >= c->num_functions)
+        return;
+
+    devs_fn_cache_entry_t *e = &c->entries[fidx];
+    if (e->num_calls < 0xffff)
+        e->num_calls++;
+    if (e->ops || e->num_calls <= DEVS_FN_CACHE_THRESHOLD)
+        return;
+    // when there was no space, try again after a while
+    if ((e->num_calls - DEVS_FN_CACHE_THRESHOLD - 1) % DEVS_FN_CACHE_THRESHOLD)
+        return;
+
+    const devs_function_desc_t *func = devs_img_get_function(ctx->img, fidx);
+    e->ops = decode_function(ctx, func, e->num_calls);
+    LOGV("decoded %s_F%d: %s", devs_img_fun_name(ctx->img, fidx), fidx, e->ops ? "ok" : "no mem");
+
+    // force devs_fn_cache_lookup() to pick it up
+    c->last_func = NULL;
+}
+
+void devs_fn_cache_free(devs_ctx_t *ctx) {
+    devs_fn_cache_t *c = ctx->fn_cache;
+    if (!c)
+        return;
+    for (unsigned i = 0; i < c->num_functions; ++i)
+        if (c->entries[i].ops)
+            devs_free(ctx, c->entries[i].ops);
+    devs_free(ctx, c);
+    ctx->fn_cache = NULL;
+}
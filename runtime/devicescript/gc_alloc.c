@@ -17,6 +17,40 @@ void devs_gc_obj_check_core(devs_gc_t *gc, const void *ptr);
 
 #define ROOT_SCAN_DEPTH 10
 
+// recursion depth when marking incrementally; kept low so that a slice doesn't run far
+// over its budget
+#define SLICE_SCAN_DEPTH 4
+
+// gray blocks past the scan depth are kept here; when it fills up, the following ones are
+// found by going over the heap again, from the first of them
+#define GC_MARK_STACK_SIZE 64
+
+// max. number of places where the shift changes, per compaction pass
+#define GC_COMPACT_ENTRIES 32
+
+// incremental collection state
+#define GC_IDLE 0
+#define GC_MARKING 1
+#define GC_SWEEPING 2
+#define GC_CLEARING 3 // making old objects young again, before marking
+
+// max. number of old objects written to between collections;
+// when exceeded, the next collection is a full one
+#define GC_REMEMBERED_SIZE 64
+
+// max. number of young objects allocated outside of the nursery between collections;
+// when exceeded, the next minor collection sweeps the whole heap
+#define GC_YOUNG_SIZE 32
+
+// max. number of pinned objects tracked as roots; when exceeded, marking goes over the heap
+// looking for the rest
+#define GC_PINNED_SIZE 16
+
+// free blocks are kept in lists by size: one list for each size up to GC_SMALL_WORDS,
+// then one for each power of two, and the last one for everything larger
+#define GC_SMALL_WORDS 8
+#define GC_NUM_CLASSES 13
+
 #define GET_TAG(p) ((p) >> DEVS_GC_TAG_POS)
 #define BASIC_TAG(p) (GET_TAG(p) & DEVS_GC_TAG_MASK)
 
@@ -55,9 +89,22 @@ typedef struct _devs_gc_block_t {
         devs_activation_t act;
         devs_bound_function_t bound_function;
         devs_packet_t pkt;
+        devs_shape_t shape;
     };
 } block_t;
 
+// blocks from `addr` up to the next entry move down by `shift` words
+typedef struct {
+    block_t *addr;
+    uint32_t shift;
+} compact_entry_t;
+
+typedef struct {
+    block_t *block;
+    uint16_t fn_idx;
+    devs_pc_t pc;
+} alloc_sample_t;
+
 typedef struct _devs_gc_chunk_t {
     struct _devs_gc_chunk_t *next;
     block_t *end; // GET_TAG(end) == DEVS_GC_TAG_FINAL
@@ -65,12 +112,68 @@ typedef struct _devs_gc_chunk_t {
 } chunk_t;
 
 struct _devs_gc_t {
-    block_t *first_free;
+    block_t *free_lists[GC_NUM_CLASSES];
+    uint32_t class_hits[GC_NUM_CLASSES];
+    uint32_t class_misses[GC_NUM_CLASSES];
     chunk_t *first_chunk;
     uint32_t num_alloc;
     uint32_t gc_threshold;
     uint32_t curr_alloc;
     devs_ctx_t *ctx;
+    // position of the current mark or sweep pass over the heap
+    chunk_t *cursor_chunk;
+    block_t *cursor;
+    int32_t budget; // blocks left to visit in this slice
+    // first gray block that didn't fit on the mark stack, if any
+    chunk_t *rescan_chunk;
+    block_t *rescan;
+    uint32_t mark_sp;
+    block_t *mark_stack[GC_MARK_STACK_SIZE];
+    // pinned objects, except for native allocations, which hold no values
+    uint16_t pinned_overflow; // ones that didn't fit
+    uint8_t num_pinned;
+    block_t *pinned[GC_PINNED_SIZE];
+    // live blocks, and words in free blocks and in the largest one, as of the last sweep
+    uint32_t survivors;
+    uint32_t survivor_words;
+    uint32_t free_words;
+    uint32_t max_free;
+    devs_gc_stats_t stats;
+#if DEVS_GC_INCREMENTAL
+    uint8_t state;
+#endif
+#if DEVS_GC_GENERATIONAL
+    // largest free block found by the last sweep; not on the free list, allocated from the front
+    block_t *nursery;
+    // the nursery as of the last sweep; no free list blocks are in there
+    block_t *nursery_start;
+    block_t *nursery_end;
+    // young objects allocated from the free lists, rather than from the nursery
+    uint8_t sweep_all; // too many of them, or not known
+    uint8_t num_young;
+    block_t *young[GC_YOUNG_SIZE];
+    uint32_t used;            // words in use after the last collection
+    uint32_t used_after_full; // same, after the last full collection
+    uint8_t full_pending;
+    uint8_t num_remembered;
+    block_t *remembered[GC_REMEMBERED_SIZE];
+#endif
+#if DEVS_GC_COMPACT
+    uint8_t compact_pending;
+    uint8_t num_entries;
+    // the chunk being compacted, and the part of it that moves in this pass
+    chunk_t *compact_chunk;
+    block_t *compact_end;
+    compact_entry_t entries[GC_COMPACT_ENTRIES];
+#endif
+#if DEVS_ALLOC_PROFILE
+    uint32_t num_unsampled; // allocations since the last sample
+    uint32_t num_samples;
+    uint32_t num_seen;    // samples taken since the program started
+    uint32_t num_dropped; // samples not kept, or evicted, because the table was full
+    alloc_sample_t samples[DEVS_ALLOC_PROFILE_SIZE];
+    devs_alloc_site_t sites[DEVS_ALLOC_PROFILE_SIZE];
+#endif
 };
 
 static inline void mark_block(devs_gc_t *gc, block_t *block, unsigned tag, unsigned size) {
@@ -112,8 +215,42 @@ void devs_gc_add_chunk(devs_gc_t *gc, void *start, unsigned size) {
     mark_block(gc, ch->start, DEVS_GC_TAG_FREE, block_ptr(ch->end) - block_ptr(ch->start));
 }
 
+unsigned devs_gc_heap_size(devs_gc_t *gc) {
+    unsigned r = 0;
+    for (chunk_t *ch = gc->first_chunk; ch; ch = ch->next)
+        r += (uint8_t *)ch->end - (uint8_t *)ch->start;
+    return r;
+}
+
 static void scan_gc_obj(devs_ctx_t *ctx, block_t *block, int depth);
 
+// the next pass over the heap has to start no later than `block`
+static void note_overflow(devs_gc_t *gc, block_t *block) {
+    for (chunk_t *ch = gc->first_chunk; ch; ch = ch->next) {
+        bool in_chunk = ch->start <= block && block < ch->end;
+        if (ch == gc->rescan_chunk) {
+            if (in_chunk && block < gc->rescan)
+                gc->rescan = block;
+            return;
+        }
+        if (in_chunk) {
+            gc->rescan_chunk = ch;
+            gc->rescan = block;
+            return;
+        }
+    }
+    JD_PANIC();
+}
+
+// reachable, but not scanned yet
+static void gray_block(devs_gc_t *gc, block_t *block) {
+    block->header |= (uintptr_t)DEVS_GC_TAG_MASK_PENDING << DEVS_GC_TAG_POS;
+    if (gc->mark_sp < GC_MARK_STACK_SIZE)
+        gc->mark_stack[gc->mark_sp++] = block;
+    else
+        note_overflow(gc, block);
+}
+
 static void scan_value(devs_ctx_t *ctx, value_t v, int depth) {
     if (devs_handle_is_ptr(v)) {
         block_t *b = devs_handle_ptr_value(ctx, v);
@@ -130,7 +267,12 @@ static void scan_array(devs_ctx_t *ctx, value_t *vals, unsigned length, int dept
 static void mark_ptr(devs_ctx_t *ctx, void *ptr) {
     JD_ASSERT(((uintptr_t)ptr & (JD_PTRSIZE - 1)) == 0);
     block_t *b = (block_t *)((uintptr_t *)ptr - 1);
+#if DEVS_GC_GENERATIONAL || DEVS_GC_INCREMENTAL
+    // data of old (or re-scanned) objects stays marked
+    JD_ASSERT((GET_TAG(b->header) & DEVS_GC_TAG_MASK_PINNED) == 0);
+#else
     JD_ASSERT((GET_TAG(b->header) & (DEVS_GC_TAG_MASK_PINNED | DEVS_GC_TAG_MASK_SCANNED)) == 0);
+#endif
     JD_ASSERT(BASIC_TAG(b->header) == DEVS_GC_TAG_BYTES);
     b->header |= (uintptr_t)DEVS_GC_TAG_MASK_SCANNED << DEVS_GC_TAG_POS;
 }
@@ -153,13 +295,17 @@ static void scan_gc_obj(devs_ctx_t *ctx, block_t *block, int depth) {
             return;
 
         if (depth <= 0) {
-            LOG("mark pending");
-            block->header |= (uintptr_t)DEVS_GC_TAG_MASK_PENDING << DEVS_GC_TAG_POS;
+            if (!(GET_TAG(header) & DEVS_GC_TAG_MASK_PENDING)) {
+                LOGV("mark pending");
+                gray_block(ctx->gc, block);
+            }
             return;
         }
 
         block->header |= (uintptr_t)DEVS_GC_TAG_MASK_SCANNED << DEVS_GC_TAG_POS;
         block->header &= ~((uintptr_t)DEVS_GC_TAG_MASK_PENDING << DEVS_GC_TAG_POS);
+        if (ctx)
+            ctx->gc->budget--;
 
         devs_map_t *map = NULL;
 
@@ -184,6 +330,11 @@ static void scan_gc_obj(devs_ctx_t *ctx, block_t *block, int depth) {
             scan_gc_obj(ctx, (block_t *)block->pkt.payload, depth);
             map = block->pkt.attached;
             break;
+        case DEVS_GC_TAG_SHAPE:
+            scan_array(ctx, block->shape.keys, block->shape.length, depth);
+            scan_gc_obj(ctx, (block_t *)block->shape.first_child, depth);
+            block = (block_t *)block->shape.next_sibling;
+            continue;
         case DEVS_GC_TAG_BOUND_FUNCTION:
             scan_value(ctx, block->bound_function.this_val, depth);
             scan_value(ctx, block->bound_function.func, depth);
@@ -205,8 +356,12 @@ static void scan_gc_obj(devs_ctx_t *ctx, block_t *block, int depth) {
 
         if (map) {
             unsigned len = map->length;
-            if (BASIC_TAG(header) != DEVS_GC_TAG_SHORT_MAP)
-                len *= 2;
+            if (BASIC_TAG(header) != DEVS_GC_TAG_SHORT_MAP) {
+                if (map->shape)
+                    scan_gc_obj(ctx, (block_t *)map->shape, depth);
+                else
+                    len *= 2;
+            }
             scan_array_and_mark(ctx, map->data, len, depth);
             if (devs_maplike_is_map(ctx, map->proto))
                 block = (void *)map->proto;
@@ -218,41 +373,101 @@ static void scan_gc_obj(devs_ctx_t *ctx, block_t *block, int depth) {
     }
 }
 
-static void mark_roots(devs_gc_t *gc) {
+// minor collections stop at old objects, and so does marking at objects already marked
+// in this cycle; this traces one again
+static void rescan_gc_obj(devs_ctx_t *ctx, block_t *block, int depth) {
+    block->header &= ~((uintptr_t)(DEVS_GC_TAG_MASK_SCANNED | DEVS_GC_TAG_MASK_REMEMBERED)
+                       << DEVS_GC_TAG_POS);
+    scan_gc_obj(ctx, block, depth);
+}
+
+#if DEVS_GC_GENERATIONAL || DEVS_GC_INCREMENTAL
+void devs_gc_write_barrier(devs_ctx_t *ctx, const void *obj) {
+    block_t *b = (block_t *)obj;
+    if (b == NULL)
+        return;
+    devs_gc_t *gc = ctx->gc;
+
+#if DEVS_GC_INCREMENTAL
+    // everything is traced again once the marks are cleared
+    if (gc->state == GC_CLEARING)
+        return;
+    if (gc->state == GC_MARKING) {
+        // a black object may now point to a white one; make it gray again
+        if (GET_TAG(b->header) & DEVS_GC_TAG_MASK_SCANNED) {
+            b->header &= ~((uintptr_t)DEVS_GC_TAG_MASK_SCANNED << DEVS_GC_TAG_POS);
+            gray_block(gc, b);
+        }
+        return;
+    }
+#endif
+
+#if DEVS_GC_GENERATIONAL
+    const unsigned mask = DEVS_GC_TAG_MASK_SCANNED | DEVS_GC_TAG_MASK_REMEMBERED;
+    // only old objects that are not remembered yet
+    if ((GET_TAG(b->header) & mask) != DEVS_GC_TAG_MASK_SCANNED)
+        return;
+    if (gc->num_remembered >= GC_REMEMBERED_SIZE) {
+        gc->full_pending = 1;
+        return;
+    }
+    b->header |= (uintptr_t)DEVS_GC_TAG_MASK_REMEMBERED << DEVS_GC_TAG_POS;
+    gc->remembered[gc->num_remembered++] = b;
+#endif
+}
+#endif
+
+static void mark_roots(devs_gc_t *gc, int depth) {
     if (gc->ctx == NULL)
         return;
     devs_ctx_t *ctx = gc->ctx;
 
-    scan_array(ctx, ctx->globals, ctx->img.header->num_globals, ROOT_SCAN_DEPTH);
-    scan_array(ctx, ctx->the_stack, ctx->stack_top_for_gc, ROOT_SCAN_DEPTH);
+    scan_array(ctx, ctx->globals, ctx->img.header->num_globals, depth);
+    scan_array(ctx, ctx->the_stack, ctx->stack_top_for_gc, depth);
 
     for (unsigned i = 0; i < ctx->_num_builtin_protos; ++i) {
         void *p = ctx->_builtin_protos[i];
-        scan_gc_obj(ctx, p, ROOT_SCAN_DEPTH);
+        scan_gc_obj(ctx, p, depth);
     }
 
     for (unsigned i = 0; i < ctx->num_roles; ++i) {
         devs_role_t *r = devs_role(ctx, i);
         if (r) {
-            scan_value(ctx, r->name, ROOT_SCAN_DEPTH);
-            scan_gc_obj(ctx, (block_t *)r->attached, ROOT_SCAN_DEPTH);
+            scan_value(ctx, r->name, depth);
+            scan_gc_obj(ctx, (block_t *)r->attached, depth);
         }
     }
 
-    scan_gc_obj(ctx, (block_t *)ctx->fn_protos, ROOT_SCAN_DEPTH);
-    scan_gc_obj(ctx, (block_t *)ctx->fn_values, ROOT_SCAN_DEPTH);
-    scan_gc_obj(ctx, (block_t *)ctx->spec_protos, ROOT_SCAN_DEPTH);
-    scan_value(ctx, ctx->exn_val, ROOT_SCAN_DEPTH);
-    scan_value(ctx, ctx->diag_field, ROOT_SCAN_DEPTH);
+    scan_gc_obj(ctx, (block_t *)ctx->fn_protos, depth);
+    scan_gc_obj(ctx, (block_t *)ctx->fn_values, depth);
+    scan_gc_obj(ctx, (block_t *)ctx->spec_protos, depth);
+    scan_gc_obj(ctx, (block_t *)ctx->shape_root, depth);
+    scan_value(ctx, ctx->exn_val, depth);
+    scan_value(ctx, ctx->diag_field, depth);
+    scan_value(ctx, ctx->stack0_this, depth);
+
+    for (unsigned i = 0; i < gc->num_pinned; ++i)
+        scan_gc_obj(ctx, gc->pinned[i], depth);
+
+#if DEVS_ACT_POOL_DEPTH
+    for (unsigned i = 0; i <= DEVS_ACT_POOL_MAX_WORDS; ++i)
+        for (devs_activation_t *act = ctx->act_pool[i]; act; act = act->caller)
+            scan_gc_obj(ctx, (void *)act, depth);
+#endif
 
     for (devs_fiber_t *fib = ctx->fibers; fib; fib = fib->next) {
-        scan_value(ctx, fib->ret_val, ROOT_SCAN_DEPTH);
+        scan_value(ctx, fib->ret_val, depth);
         if (devs_fiber_uses_pkt_data_v(fib))
-            scan_value(ctx, fib->pkt_data.v, ROOT_SCAN_DEPTH);
-        for (devs_activation_t *act = fib->activation; act; act = act->caller) {
-            scan_gc_obj(ctx, (void *)act, ROOT_SCAN_DEPTH);
-        }
+            scan_value(ctx, fib->pkt_data.v, depth);
+        // slots of running functions are written without barriers
+        for (devs_activation_t *act = fib->activation; act; act = act->caller)
+            rescan_gc_obj(ctx, (void *)act, depth);
     }
+
+#if DEVS_GC_GENERATIONAL
+    for (unsigned i = 0; i < gc->num_remembered; ++i)
+        rescan_gc_obj(ctx, gc->remembered[i], depth);
+#endif
 }
 
 // in words
@@ -280,64 +495,303 @@ static void clear_weak_pointers(devs_ctx_t *ctx) {
         ctx->step_fn = NULL;
 }
 
-static void sweep(devs_gc_t *gc) {
-    int sweep = 0;
-    block_t *prev = NULL;
-    gc->first_free = NULL;
-    gc->curr_alloc = 0;
+static unsigned size_class(unsigned words) {
+    if (words <= GC_SMALL_WORDS)
+        return words - 2;
+    unsigned c = GC_SMALL_WORDS - 1;
+    unsigned limit = GC_SMALL_WORDS * 2;
+    while (words > limit && c < GC_NUM_CLASSES - 1) {
+        c++;
+        limit <<= 1;
+    }
+    return c;
+}
+
+static void push_free_block(devs_gc_t *gc, block_t *block) {
+    unsigned c = size_class(block_size(block));
+    block->free.next = gc->free_lists[c];
+    gc->free_lists[c] = block;
+}
+
+static void keep_block(devs_gc_t *gc, block_t *block) {
+    gc->survivors++;
+    gc->survivor_words += block_size(block);
+#if DEVS_GC_GENERATIONAL
+    gc->used += block_size(block);
+    // survivors stay marked (old), except for pinned native allocations, which hold no values
+    // and are expected to be unmarked by jd_gc_unpin()
+    if (GET_TAG(block->header) !=
+        (DEVS_GC_TAG_MASK_SCANNED | DEVS_GC_TAG_MASK_PINNED | DEVS_GC_TAG_BYTES))
+        return;
+#endif
+    block->header = block->header & ~((uintptr_t)DEVS_GC_TAG_MASK_SCANNED << DEVS_GC_TAG_POS);
+}
+
+static inline bool gc_in_cycle(devs_gc_t *gc) {
+#if DEVS_GC_INCREMENTAL
+    return gc->state != GC_IDLE;
+#else
+    return false;
+#endif
+}
 
+static void reset_cursor(devs_gc_t *gc) {
+    gc->cursor_chunk = gc->first_chunk;
+    gc->cursor = gc->cursor_chunk ? gc->cursor_chunk->start : NULL;
+}
+
+// returns false at the end of the heap
+static bool next_chunk(devs_gc_t *gc) {
+    gc->cursor_chunk = gc->cursor_chunk->next;
+    if (gc->cursor_chunk == NULL)
+        return false;
+    gc->cursor = gc->cursor_chunk->start;
+    return true;
+}
+
+static void start_marking(devs_gc_t *gc) {
+    gc->mark_sp = 0;
+    gc->rescan_chunk = NULL;
+    // pinned objects are roots; the ones not on the list have to be found
+    if (gc->pinned_overflow)
+        reset_cursor(gc);
+    else
+        gc->cursor_chunk = NULL;
+}
+
+// Scans gray blocks from the mark stack, and goes over the heap looking for gray ones that
+// didn't fit on the stack (and for pinned ones, see start_marking()), until the budget runs out.
+// Returns true when there's nothing left to scan.
+static bool mark_slice(devs_gc_t *gc, int depth) {
     for (;;) {
-        int had_pending = 0;
-        for (chunk_t *chunk = gc->first_chunk; chunk; chunk = chunk->next) {
-            for (block_t *block = chunk->start;; block = next_block(block)) {
-                uintptr_t header = block->header;
-                unsigned tag = GET_TAG(header);
-                if (tag == DEVS_GC_TAG_FINAL)
-                    break;
-                JD_ASSERT(block < chunk->end);
-
-                if (!sweep)
-                    LOGV("p=%p tag=%x", block, (unsigned)tag);
-
-                if ((tag & DEVS_GC_TAG_MASK_PENDING) ||
-                    (tag & (DEVS_GC_TAG_MASK_PINNED | DEVS_GC_TAG_MASK_SCANNED)) ==
-                        DEVS_GC_TAG_MASK_PINNED) {
-                    JD_ASSERT(!sweep);
-                    if (!had_pending)
-                        LOG("set pending");
-                    had_pending = 1;
-                    scan_gc_obj(gc->ctx, block, ROOT_SCAN_DEPTH);
-                } else if (sweep) {
-                    block_t *p = block;
-                    while (can_free(p->header)) {
-                        if (GET_TAG(p->header) != DEVS_GC_TAG_FREE)
-                            LOG("free: %p", p);
-                        p = next_block(p);
-                    }
-                    if (p != block) {
-                        unsigned new_size = block_ptr(p) - block_ptr(block);
-                        mark_block(gc, block, DEVS_GC_TAG_FREE, new_size);
-                        if (prev == NULL) {
-                            gc->first_free = block;
-                        } else {
-                            prev->free.next = block;
-                        }
-                        block->free.next = NULL;
-                        prev = block;
-                    } else {
-                        block->header = block->header &
-                                        ~((uintptr_t)DEVS_GC_TAG_MASK_SCANNED << DEVS_GC_TAG_POS);
-                    }
-                }
-            }
+        while (gc->mark_sp > 0 && gc->budget > 0) {
+            block_t *block = gc->mark_stack[--gc->mark_sp];
+            // might have been reached some other way in the meantime
+            if (GET_TAG(block->header) & DEVS_GC_TAG_MASK_PENDING)
+                scan_gc_obj(gc->ctx, block, depth);
         }
-        if (sweep)
+
+        if (gc->budget <= 0)
+            return false;
+
+        if (gc->cursor_chunk == NULL) {
+            if (gc->rescan_chunk == NULL)
+                return true;
+            LOG("mark stack overflow; rescan from %p", gc->rescan);
+            gc->cursor_chunk = gc->rescan_chunk;
+            gc->cursor = gc->rescan;
+            gc->rescan_chunk = NULL;
+        }
+
+        block_t *block = gc->cursor;
+        uintptr_t header = block->header;
+        unsigned tag = GET_TAG(header);
+        if (tag == DEVS_GC_TAG_FINAL) {
+            next_chunk(gc);
+            continue;
+        }
+        JD_ASSERT(block < gc->cursor_chunk->end);
+
+        LOGV("p=%p tag=%x", block, (unsigned)tag);
+
+        if ((tag & DEVS_GC_TAG_MASK_PENDING) ||
+            (tag & (DEVS_GC_TAG_MASK_PINNED | DEVS_GC_TAG_MASK_SCANNED)) ==
+                DEVS_GC_TAG_MASK_PINNED)
+            scan_gc_obj(gc->ctx, block, depth);
+        gc->cursor = next_block(block);
+        gc->budget--;
+    }
+}
+
+static void clear_free_lists(devs_gc_t *gc) {
+    memset(gc->free_lists, 0, sizeof(gc->free_lists));
+#if DEVS_GC_GENERATIONAL
+    gc->nursery = gc->nursery_start = gc->nursery_end = NULL;
+#endif
+    gc->free_words = 0;
+    gc->max_free = 0;
+}
+
+// makes one free block out of blocks from `block` up to `end`
+static void add_free_run(devs_gc_t *gc, block_t *block, block_t *end) {
+    unsigned new_size = block_ptr(end) - block_ptr(block);
+    mark_block(gc, block, DEVS_GC_TAG_FREE, new_size);
+    gc->free_words += new_size;
+    if (new_size > gc->max_free)
+        gc->max_free = new_size;
+    block_t *fb = block;
+#if DEVS_GC_GENERATIONAL
+    if (gc->nursery == NULL || new_size > block_size(gc->nursery)) {
+        fb = gc->nursery;
+        gc->nursery = gc->nursery_start = block;
+        gc->nursery_end = end;
+    }
+#endif
+    if (fb)
+        push_free_block(gc, fb);
+}
+
+#if DEVS_ALLOC_PROFILE
+// called once marking is done, before anything is freed
+static void drop_dead_samples(devs_gc_t *gc) {
+    unsigned n = 0;
+    for (unsigned i = 0; i < gc->num_samples; ++i)
+        if (!can_free(gc->samples[i].block->header))
+            gc->samples[n++] = gc->samples[i];
+    gc->num_samples = n;
+}
+#endif
+
+// `all` is false for sweep_young()
+static void start_sweep(devs_gc_t *gc, bool all) {
+    clear_weak_pointers(gc->ctx);
+#if DEVS_ALLOC_PROFILE
+    drop_dead_samples(gc);
+#endif
+    gc->curr_alloc = 0;
+#if DEVS_GC_GENERATIONAL
+    gc->num_remembered = 0;
+    gc->full_pending = 0;
+    if (!all)
+        return;
+    gc->used = 0;
+    gc->num_young = 0;
+    gc->sweep_all = 0;
+#endif
+    clear_free_lists(gc);
+    gc->survivors = 0;
+    gc->survivor_words = 0;
+    reset_cursor(gc);
+}
+
+// chunks are in address order, so everything before the cursor was swept already
+static inline bool swept(devs_gc_t *gc, block_t *block) {
+    return gc->cursor_chunk == NULL || block < gc->cursor;
+}
+
+// Frees unmarked blocks from the cursor on, until the budget runs out; returns true when done.
+// Only blocks before the cursor are on the free lists, so the ones after it, that are still
+// to be swept, are never allocated in the meantime.
+static bool sweep_slice(devs_gc_t *gc) {
+    if (gc->cursor_chunk == NULL)
+        return true;
+    while (gc->budget > 0) {
+        block_t *block = gc->cursor;
+        if (GET_TAG(block->header) == DEVS_GC_TAG_FINAL) {
+            if (!next_chunk(gc))
+                return true;
+            continue;
+        }
+        JD_ASSERT(block < gc->cursor_chunk->end);
+
+        block_t *p = block;
+        while (can_free(p->header)) {
+            if (GET_TAG(p->header) != DEVS_GC_TAG_FREE)
+                LOG("free: %p", p);
+            p = next_block(p);
+            gc->budget--;
+        }
+        if (p != block) {
+            add_free_run(gc, block, p);
+        } else {
+            keep_block(gc, block);
+            p = next_block(block);
+            gc->budget--;
+        }
+        gc->cursor = p;
+    }
+    return false;
+}
+
+#if DEVS_GC_GENERATIONAL
+static void note_young(devs_gc_t *gc, block_t *block) {
+    if (gc->num_young < GC_YOUNG_SIZE)
+        gc->young[gc->num_young++] = block;
+    else
+        gc->sweep_all = 1;
+}
+
+static void forget_young(devs_gc_t *gc, block_t *block) {
+    for (unsigned i = 0; i < gc->num_young; ++i)
+        if (gc->young[i] == block) {
+            gc->young[i] = gc->young[--gc->num_young];
             break;
-        if (!had_pending) {
-            clear_weak_pointers(gc->ctx);
-            sweep = 1;
         }
+}
+
+static bool in_nursery(devs_gc_t *gc, block_t *block) {
+    return gc->nursery_start <= block && block < gc->nursery_end;
+}
+
+// Minor collections only free young objects, so unless sweep_all is set, only the nursery is
+// swept, along with the blocks from note_young(). The largest free run in the nursery becomes
+// the new one, and the rest goes on the free lists, which are otherwise left alone.
+static void sweep_young(devs_gc_t *gc) {
+    // the amount of free space is only known after a sweep of the whole heap
+    uint32_t free_words = gc->free_words;
+    uint32_t max_free = gc->max_free;
+
+    block_t *block = gc->nursery_start;
+    block_t *end = gc->nursery_end;
+    gc->nursery = gc->nursery_start = gc->nursery_end = NULL;
+    while (block < end) {
+        block_t *p = block;
+        while (p < end && can_free(p->header))
+            p = next_block(p);
+        if (p != block) {
+            add_free_run(gc, block, p);
+        } else {
+            keep_block(gc, block);
+            p = next_block(block);
+        }
+        block = p;
     }
+
+    for (unsigned i = 0; i < gc->num_young; ++i) {
+        block = gc->young[i];
+        if (can_free(block->header)) {
+            LOG("free: %p", block);
+            mark_block(gc, block, DEVS_GC_TAG_FREE, block_size(block));
+            push_free_block(gc, block);
+        } else {
+            keep_block(gc, block);
+        }
+    }
+    gc->num_young = 0;
+
+    gc->free_words = free_words;
+    gc->max_free = max_free;
+}
+#endif
+
+static void update_free_stats(devs_gc_t *gc) {
+    devs_gc_stats_t *st = &gc->stats;
+    st->free_bytes = gc->free_words * JD_PTRSIZE;
+    st->max_free_block = gc->max_free * JD_PTRSIZE;
+    st->fragmentation = gc->free_words ? 1000 - gc->max_free * 1000 / gc->free_words : 0;
+}
+
+static void end_sweep(devs_gc_t *gc, bool full) {
+    devs_gc_stats_t *st = &gc->stats;
+    st->num_gc++;
+    if (full || !DEVS_GC_GENERATIONAL)
+        st->num_full_gc++;
+    st->survivors = gc->survivors;
+    st->survivor_bytes = gc->survivor_words * JD_PTRSIZE;
+    update_free_stats(gc);
+
+#if DEVS_GC_GENERATIONAL
+    if (full)
+        gc->used_after_full = gc->used;
+    else if (gc->used > gc->used_after_full + gc->gc_threshold)
+        gc->full_pending = 1; // enough was promoted since the last full collection
+#endif
+#if DEVS_GC_COMPACT
+    // there is enough memory for a large allocation, just not in one piece
+    if (full && gc->max_free * JD_PTRSIZE < DEVS_GC_COMPACT_THRESHOLD &&
+        gc->free_words * JD_PTRSIZE >= DEVS_GC_COMPACT_THRESHOLD)
+        gc->compact_pending = 1;
+#endif
 }
 
 static void validate_heap(devs_gc_t *gc) {
@@ -363,45 +817,519 @@ static void validate_heap(devs_gc_t *gc) {
     }
 }
 
-static void devs_gc(devs_gc_t *gc) {
+#if DEVS_GC_GENERATIONAL || DEVS_GC_INCREMENTAL
+// Makes everything white (and young) again before a full collection, from the cursor on, until
+// the budget runs out; returns true when done.
+static bool clear_slice(devs_gc_t *gc) {
+    const uintptr_t mask =
+        DEVS_GC_TAG_MASK_SCANNED | DEVS_GC_TAG_MASK_REMEMBERED | DEVS_GC_TAG_MASK_PENDING;
+    if (gc->cursor_chunk == NULL)
+        return true;
+    while (gc->budget > 0) {
+        block_t *block = gc->cursor;
+        if (GET_TAG(block->header) == DEVS_GC_TAG_FINAL) {
+            if (!next_chunk(gc))
+                return true;
+            continue;
+        }
+        block->header &= ~(mask << DEVS_GC_TAG_POS);
+        gc->cursor = next_block(block);
+        gc->budget--;
+    }
+    return false;
+}
+
+static void clear_marks(devs_gc_t *gc) {
+    reset_cursor(gc);
+    gc->budget = INT32_MAX;
+    clear_slice(gc);
+#if DEVS_GC_GENERATIONAL
+    gc->num_remembered = 0;
+#endif
+}
+#endif
+
+static void invalidate_caches(devs_gc_t *gc) {
+    // inline caches hold raw pointers to objects that may have been freed
+    if (gc->ctx)
+        devs_field_ic_invalidate(gc->ctx);
+}
+
+// `t0` is tim_get_micros() from the start of the pause
+static void end_pause(devs_gc_t *gc, uint64_t t0) {
+    uint32_t us = (uint32_t)(tim_get_micros() - t0);
+    gc->stats.total_pause_us += us;
+    if (us > gc->stats.max_pause_us)
+        gc->stats.max_pause_us = us;
+}
+
+#if DEVS_GC_INCREMENTAL
+// roots are written without barriers, so they are scanned again, and the rest of the marking
+// is done in one go
+static void finish_marking(devs_gc_t *gc) {
+    gc->budget = INT32_MAX;
+    mark_roots(gc, ROOT_SCAN_DEPTH);
+    mark_slice(gc, ROOT_SCAN_DEPTH);
+    // the mutator only gets to live objects from now on, so this is needed only once
+    invalidate_caches(gc);
+    start_sweep(gc, true);
+#if DEVS_GC_GENERATIONAL
+    // objects allocated during the sweep are not tracked
+    gc->sweep_all = 1;
+#endif
+    gc->state = GC_SWEEPING;
+}
+
+// only makes the roots gray; they are scanned by the following slices
+static void start_cycle_marking(devs_gc_t *gc) {
+    gc->state = GC_MARKING;
+    start_marking(gc);
+    mark_roots(gc, 1);
+}
+
+static void finish_cycle(devs_gc_t *gc) {
+    if (gc->state == GC_CLEARING) {
+        gc->budget = INT32_MAX;
+        clear_slice(gc);
+        start_cycle_marking(gc);
+    }
+    if (gc->state == GC_MARKING)
+        finish_marking(gc);
+    gc->budget = INT32_MAX;
+    sweep_slice(gc);
+    end_sweep(gc, true);
+    gc->state = GC_IDLE;
+}
+
+static void incremental_step(devs_gc_t *gc) {
+    uint64_t t0 = tim_get_micros();
+    gc->budget = DEVS_GC_SLICE_BUDGET;
+
+    switch (gc->state) {
+    case GC_IDLE:
+#if DEVS_GC_GENERATIONAL
+        // minor collections are short, only full ones are done incrementally
+        if (!gc->full_pending)
+            return;
+        LOG("*** GC start");
+        gc->full_pending = 0;
+        gc->num_remembered = 0;
+        gc->state = GC_CLEARING;
+        reset_cursor(gc);
+#else
+        if (gc->curr_alloc < gc->gc_threshold / 2)
+            return;
+        LOG("*** GC start");
+        start_cycle_marking(gc);
+#endif
+        break;
+
+    case GC_CLEARING:
+        if (clear_slice(gc))
+            start_cycle_marking(gc);
+        break;
+
+    case GC_MARKING:
+        if (mark_slice(gc, SLICE_SCAN_DEPTH)) {
+            LOG("*** GC marked");
+            finish_marking(gc);
+        }
+        break;
+
+    case GC_SWEEPING:
+        if (sweep_slice(gc)) {
+            LOG("*** GC swept");
+            end_sweep(gc, true);
+            gc->state = GC_IDLE;
+        }
+        break;
+    }
+
+    end_pause(gc, t0);
+}
+#endif
+
+// without DEVS_GC_GENERATIONAL all collections are full
+static void devs_gc(devs_gc_t *gc, bool full) {
+    uint64_t t0 = tim_get_micros();
+#if DEVS_GC_INCREMENTAL
+    if (gc->state != GC_IDLE) {
+        LOG("*** GC finish");
+        finish_cycle(gc);
+        end_pause(gc, t0);
+        return;
+    }
+#endif
+#if DEVS_GC_GENERATIONAL
+    full = full || gc->full_pending;
+    LOG("*** GC %s", full ? "full" : "minor");
+    if (full)
+        clear_marks(gc);
+#else
     LOG("*** GC");
-    mark_roots(gc);
-    sweep(gc);
+#endif
+    gc->budget = INT32_MAX;
+    start_marking(gc);
+    mark_roots(gc, ROOT_SCAN_DEPTH);
+    mark_slice(gc, ROOT_SCAN_DEPTH);
+#if DEVS_GC_GENERATIONAL
+    if (!full && !gc->sweep_all && gc->nursery_end) {
+        start_sweep(gc, false);
+        sweep_young(gc);
+    } else {
+        start_sweep(gc, true);
+        sweep_slice(gc);
+    }
+#else
+    start_sweep(gc, true);
+    sweep_slice(gc);
+#endif
+    end_sweep(gc, full);
+    invalidate_caches(gc);
+    end_pause(gc, t0);
 }
 
-static block_t *find_free_block(devs_gc_t *gc, unsigned tag, uint32_t words) {
-    block_t *prev = NULL;
-    for (block_t *b = gc->first_free; b; prev = b, b = b->free.next) {
-        unsigned bsz = block_size(b);
-        int left = bsz - words;
-        if (left < 0)
+#if DEVS_GC_COMPACT
+// new address of anything inside a block that moves in the current compaction pass
+static void *fwd(devs_gc_t *gc, const void *ptr) {
+    block_t *p = (block_t *)ptr;
+    if (p < gc->compact_chunk->start || p >= gc->compact_end || p < gc->entries[0].addr)
+        return p;
+    unsigned l = 0, r = gc->num_entries - 1;
+    while (l < r) {
+        unsigned m = (l + r + 1) / 2;
+        if (gc->entries[m].addr <= p)
+            l = m;
+        else
+            r = m - 1;
+    }
+    return (uint8_t *)p - gc->entries[l].shift * JD_PTRSIZE;
+}
+
+#define FWD(field) (field) = fwd(gc, (field))
+
+static void fwd_values(devs_gc_t *gc, value_t *vals, unsigned length) {
+    for (unsigned i = 0; i < length; ++i) {
+        if (devs_handle_is_ptr(vals[i])) {
+            uint8_t *p = devs_handle_ptr_value(gc->ctx, vals[i]);
+            // keep the handle type and high bits (eg. function index of closures)
+            vals[i].mantisa32 -= p - (uint8_t *)fwd(gc, p);
+        }
+    }
+}
+
+static void fwd_map(devs_gc_t *gc, devs_map_t *map, unsigned tag) {
+    if (tag == DEVS_GC_TAG_SHORT_MAP) {
+        fwd_values(gc, map->data, map->length);
+    } else {
+        fwd_values(gc, map->data, map->shape ? map->length : map->length * 2);
+        FWD(map->shape);
+    }
+    FWD(map->data);
+    FWD(map->proto);
+}
+
+static void fwd_block(devs_gc_t *gc, block_t *block) {
+    switch (BASIC_TAG(block->header)) {
+    case DEVS_GC_TAG_BUFFER:
+        FWD(block->buffer.attached);
+        break;
+    case DEVS_GC_TAG_IMAGE:
+        FWD(block->image.pix); // only when it points into the buffer
+        FWD(block->image.buffer);
+        FWD(block->image.attached);
+        break;
+    case DEVS_GC_TAG_SHORT_MAP:
+    case DEVS_GC_TAG_HALF_STATIC_MAP:
+    case DEVS_GC_TAG_MAP:
+        fwd_map(gc, &block->map, BASIC_TAG(block->header));
+        break;
+    case DEVS_GC_TAG_ARRAY:
+        fwd_values(gc, block->array.data, block->array.length);
+        FWD(block->array.data);
+        FWD(block->array.attached);
+        break;
+    case DEVS_GC_TAG_PACKET:
+        FWD(block->pkt.payload);
+        FWD(block->pkt.attached);
+        break;
+    case DEVS_GC_TAG_SHAPE:
+        fwd_values(gc, block->shape.keys, block->shape.length);
+        FWD(block->shape.first_child);
+        FWD(block->shape.next_sibling);
+        break;
+    case DEVS_GC_TAG_BOUND_FUNCTION:
+        fwd_values(gc, &block->bound_function.this_val, 1);
+        fwd_values(gc, &block->bound_function.func, 1);
+        break;
+    case DEVS_GC_TAG_ACTIVATION:
+        fwd_values(gc, block->act.slots, block->act.func->num_slots);
+        FWD(block->act.closure);
+        FWD(block->act.caller);
+        break;
+    default:
+        // the values in data of arrays and maps are handled with their owner
+        break;
+    }
+}
+
+// everything mark_roots() looks at, and other pointers kept outside of the heap
+static void fwd_roots(devs_gc_t *gc) {
+    devs_ctx_t *ctx = gc->ctx;
+
+    fwd_values(gc, ctx->globals, ctx->img.header->num_globals);
+    fwd_values(gc, ctx->the_stack, ctx->stack_top_for_gc);
+
+    for (unsigned i = 0; i < ctx->_num_builtin_protos; ++i)
+        FWD(ctx->_builtin_protos[i]);
+
+    for (unsigned i = 0; i < ctx->num_roles; ++i) {
+        devs_role_t *r = devs_role(ctx, i);
+        if (r) {
+            fwd_values(gc, &r->name, 1);
+            FWD(r->attached);
+        }
+    }
+
+    FWD(ctx->fn_protos);
+    FWD(ctx->fn_values);
+    FWD(ctx->spec_protos);
+    FWD(ctx->shape_root);
+    fwd_values(gc, &ctx->exn_val, 1);
+    fwd_values(gc, &ctx->diag_field, 1);
+    fwd_values(gc, &ctx->stack0_this, 1);
+    FWD(ctx->curr_fn);
+    FWD(ctx->step_fn);
+#if DEVS_ACT_POOL_DEPTH
+    // the rest of each list is linked through caller, forwarded with the blocks
+    for (unsigned i = 0; i <= DEVS_ACT_POOL_MAX_WORDS; ++i)
+        FWD(ctx->act_pool[i]);
+#endif
+
+#if DEVS_ALLOC_PROFILE
+    for (unsigned i = 0; i < gc->num_samples; ++i)
+        FWD(gc->samples[i].block);
+#endif
+
+    for (devs_fiber_t *fib = ctx->fibers; fib; fib = fib->next) {
+        fwd_values(gc, &fib->ret_val, 1);
+        if (devs_fiber_uses_pkt_data_v(fib))
+            fwd_values(gc, &fib->pkt_data.v, 1);
+        FWD(fib->activation);
+    }
+}
+
+// Plans a pass over `chunk`: live blocks slide down over the free ones, but not past pinned
+// blocks. Returns false if there is nothing to move.
+static bool plan_compaction(devs_gc_t *gc, chunk_t *chunk) {
+    unsigned shift = 0, curr = 0;
+    gc->compact_chunk = chunk;
+    gc->num_entries = 0;
+
+    block_t *block = chunk->start;
+    for (; GET_TAG(block->header) != DEVS_GC_TAG_FINAL; block = next_block(block)) {
+        if (IS_FREE(block->header)) {
+            shift += block_size(block);
             continue;
+        }
+        bool pinned = (GET_TAG(block->header) & DEVS_GC_TAG_MASK_PINNED) != 0;
+        unsigned s = pinned ? 0 : shift;
+        if (s != curr) {
+            // one entry is kept for the end
+            if (gc->num_entries == GC_COMPACT_ENTRIES - 1)
+                break;
+            gc->entries[gc->num_entries++] = (compact_entry_t){block, s};
+            curr = s;
+        }
+        if (pinned)
+            shift = 0;
+    }
 
-        block_t *next;
-        if (left > 2) {
-            // split block
-            mark_block(gc, b, tag, words);
-            next = next_block(b);
-            // mark_block() below can overwrite b->free.next when words==0, so do this first
-            next->free.next = b->free.next;
-            mark_block(gc, next, DEVS_GC_TAG_FREE, left);
-        } else {
-            mark_block(gc, b, tag, block_size(b));
-            next = b->free.next;
+    gc->compact_end = block;
+    if (curr)
+        gc->entries[gc->num_entries++] = (compact_entry_t){block, 0};
+
+    return gc->num_entries > 0;
+}
+
+// moves blocks as planned; the free space ends up before each pinned block, and at the end
+static void move_blocks(devs_gc_t *gc) {
+    unsigned shift = 0;
+    block_t *block = gc->compact_chunk->start;
+    while (block != gc->compact_end) {
+        unsigned size = block_size(block);
+        block_t *next = (block_t *)(block_ptr(block) + size);
+        if (IS_FREE(block->header)) {
+            shift += size;
+        } else if (GET_TAG(block->header) & DEVS_GC_TAG_MASK_PINNED) {
+            if (shift)
+                mark_block(gc, (block_t *)(block_ptr(block) - shift), DEVS_GC_TAG_FREE, shift);
+            shift = 0;
+        } else if (shift) {
+            memmove(block_ptr(block) - shift, block, size * JD_PTRSIZE);
         }
+        block = next;
+    }
+    if (shift)
+        mark_block(gc, (block_t *)(block_ptr(block) - shift), DEVS_GC_TAG_FREE, shift);
+}
 
-        if (prev == NULL) {
-            gc->first_free = next;
-        } else {
-            prev->free.next = next;
+static void rebuild_free_lists(devs_gc_t *gc) {
+    clear_free_lists(gc);
+    for (chunk_t *chunk = gc->first_chunk; chunk; chunk = chunk->next) {
+        block_t *block = chunk->start;
+        while (GET_TAG(block->header) != DEVS_GC_TAG_FINAL) {
+            block_t *p = block;
+            while (IS_FREE(p->header))
+                p = next_block(p);
+            if (p != block) {
+                add_free_run(gc, block, p);
+                block = p;
+            } else {
+                block = next_block(block);
+            }
+        }
+    }
+}
+
+// Has to run at a point where native code doesn't hold pointers to GC objects, other than
+// pinned ones (which don't move).
+static void compact(devs_gc_t *gc) {
+    LOG("*** GC compact");
+    devs_gc(gc, true); // everything left is live; counted as a separate pause
+    uint64_t t0 = tim_get_micros();
+
+    for (chunk_t *chunk = gc->first_chunk; chunk; chunk = chunk->next) {
+        // each pass handles up to GC_COMPACT_ENTRIES places where the shift changes,
+        // starting from the beginning of the chunk
+        while (plan_compaction(gc, chunk)) {
+            for (chunk_t *ch = gc->first_chunk; ch; ch = ch->next) {
+                for (block_t *b = ch->start; GET_TAG(b->header) != DEVS_GC_TAG_FINAL;
+                     b = next_block(b))
+                    if (!IS_FREE(b->header))
+                        fwd_block(gc, b);
+            }
+            fwd_roots(gc);
+            move_blocks(gc);
         }
+    }
+
+    rebuild_free_lists(gc);
+    update_free_stats(gc);
+    gc->compact_pending = 0;
+    gc->stats.num_compactions++;
+    invalidate_caches(gc);
+    end_pause(gc, t0);
+    LOG("*** GC compacted, max free block %d B", (int)(gc->max_free * JD_PTRSIZE));
+}
+#endif
+
+#if DEVS_GC_INCREMENTAL || DEVS_GC_COMPACT
+void devs_gc_step(devs_gc_t *gc) {
+    if (gc->ctx == NULL)
+        return;
+#if DEVS_GC_COMPACT
+    if (gc->compact_pending && !gc_in_cycle(gc)) {
+        compact(gc);
+        return;
+    }
+#endif
+#if DEVS_GC_INCREMENTAL
+    incremental_step(gc);
+#endif
+}
+#endif
+
+// the free remainder of `b` after the first `words`; free blocks are already filled,
+// so this doesn't need mark_block()
+static block_t *split_free_block(block_t *b, unsigned words) {
+    block_t *rest = (block_t *)(block_ptr(b) + words);
+    rest->header = DEVS_GC_MK_TAG_WORDS(DEVS_GC_TAG_FREE, block_size(b) - words);
+    rest->free.next = NULL;
+    return rest;
+}
+
+// `b` follows `prev` (if any) on list `c`
+static block_t *take_free_block(devs_gc_t *gc, unsigned c, block_t *prev, block_t *b, unsigned tag,
+                                uint32_t words) {
+    if (prev == NULL) {
+        gc->free_lists[c] = b->free.next;
+    } else {
+        prev->free.next = b->free.next;
+    }
+
+    int left = block_size(b) - words;
+    if (left > 2) {
+        push_free_block(gc, split_free_block(b, words));
+        mark_block(gc, b, tag, words);
+    } else {
+        mark_block(gc, b, tag, block_size(b));
+    }
+
+    return b;
+}
+
+// small classes hold blocks of one size, so this is O(1) for them
+static block_t *find_in_class(devs_gc_t *gc, unsigned c, unsigned tag, uint32_t words) {
+    block_t *prev = NULL;
+    for (block_t *b = gc->free_lists[c]; b; prev = b, b = b->free.next) {
+        if (block_size(b) >= words)
+            return take_free_block(gc, c, prev, b, tag, words);
+    }
+    return NULL;
+}
+
+#if DEVS_GC_GENERATIONAL
+static block_t *nursery_alloc(devs_gc_t *gc, unsigned tag, uint32_t words) {
+    block_t *b = gc->nursery;
+    if (b == NULL)
+        return NULL;
+    unsigned bsz = block_size(b);
+    if (bsz >= words + 2) {
+        gc->nursery = split_free_block(b, words);
+    } else if (bsz == words) {
+        gc->nursery = NULL;
+    } else {
+        return NULL;
+    }
+    b->header = DEVS_GC_MK_TAG_WORDS(tag, words);
+    return b;
+}
+#endif
 
+static block_t *alloc_from_lists(devs_gc_t *gc, unsigned tag, uint32_t words) {
+    unsigned c = size_class(words);
+    block_t *b = find_in_class(gc, c, tag, words);
+    if (b) {
+        gc->class_hits[c]++;
         return b;
     }
+    gc->class_misses[c]++;
+
+    // any block in a larger class is big enough
+    while (++c < GC_NUM_CLASSES) {
+        if (gc->free_lists[c])
+            return take_free_block(gc, c, NULL, gc->free_lists[c], tag, words);
+    }
 
     return NULL;
 }
 
+static block_t *alloc_free_block(devs_gc_t *gc, unsigned tag, uint32_t words) {
+#if DEVS_GC_GENERATIONAL
+    // young objects are kept together, so that minor collections only sweep the nursery
+    block_t *b = nursery_alloc(gc, tag, words);
+    if (b)
+        return b;
+    b = alloc_from_lists(gc, tag, words);
+    if (b)
+        note_young(gc, b);
+    return b;
+#else
+    return alloc_from_lists(gc, tag, words);
+#endif
+}
+
 static block_t *alloc_block(devs_gc_t *gc, unsigned tag, unsigned size) {
     JD_ASSERT(!target_in_irq());
 
@@ -419,38 +1347,141 @@ static block_t *alloc_block(devs_gc_t *gc, unsigned tag, unsigned size) {
 
     if (devs_get_global_flags() & DEVS_FLAG_GC_STRESS) {
         validate_heap(gc);
-        devs_gc(gc);
-    } else if (gc->curr_alloc > gc->gc_threshold) {
-        devs_gc(gc);
+        // mostly minor ones, which depend on the write barriers
+        devs_gc(gc, (gc->num_alloc & 7) == 0);
+    } else if (gc->curr_alloc > gc->gc_threshold && !gc_in_cycle(gc)) {
+        devs_gc(gc, false);
     }
     gc->curr_alloc += words;
 
-    block_t *b = find_free_block(gc, tag, words);
+    block_t *b = alloc_free_block(gc, tag, words);
     if (!b) {
-        devs_gc(gc);
-        b = find_free_block(gc, tag, words);
+        devs_gc(gc, false);
+        b = alloc_free_block(gc, tag, words);
     }
+#if DEVS_GC_GENERATIONAL
+    if (!b) {
+        // old objects might have died as well
+        devs_gc(gc, true);
+        b = alloc_free_block(gc, tag, words);
+    }
+#endif
 
     // DMESG("b=%p %p",b,(void*)b->header);
 
     return b;
 }
 
+// pins are short-lived and nested, so the one being removed is usually the last one
+static void add_pinned(devs_gc_t *gc, block_t *block) {
+    if (gc->num_pinned < GC_PINNED_SIZE)
+        gc->pinned[gc->num_pinned++] = block;
+    else
+        gc->pinned_overflow++;
+}
+
+static void remove_pinned(devs_gc_t *gc, block_t *block) {
+    for (unsigned i = gc->num_pinned; i-- > 0;)
+        if (gc->pinned[i] == block) {
+            gc->pinned[i] = gc->pinned[--gc->num_pinned];
+            return;
+        }
+    JD_ASSERT(gc->pinned_overflow > 0);
+    gc->pinned_overflow--;
+}
+
 void *jd_gc_any_try_alloc(devs_gc_t *gc, unsigned tag, uint32_t size) {
     if (size > DEVS_MAX_ALLOC)
         return NULL;
     block_t *b = alloc_block(gc, tag, size);
     if (!b)
         return NULL;
+    if ((tag & DEVS_GC_TAG_MASK_PINNED) && (tag & DEVS_GC_TAG_MASK) != DEVS_GC_TAG_BYTES)
+        add_pinned(gc, b);
+#if DEVS_GC_INCREMENTAL
+    // pinned blocks are roots, but the marking pass over the heap might be past this one already
+    if (gc->state == GC_MARKING && (tag & DEVS_GC_TAG_MASK_PINNED))
+        b->header |= (uintptr_t)DEVS_GC_TAG_MASK_SCANNED << DEVS_GC_TAG_POS;
+#endif
+    gc->stats.alloc_bytes[tag & DEVS_GC_TAG_MASK] += block_size(b) * JD_PTRSIZE;
     memset(b->data, 0x00, size - JD_PTRSIZE);
     LOG("alloc: tag=%s sz=%d -> %p", devs_gc_tag_name(tag), (int)size, b);
     return b;
 }
 
+#if DEVS_ALLOC_PROFILE
+static void sample_alloc(devs_ctx_t *ctx, block_t *block) {
+    devs_gc_t *gc = ctx->gc;
+    if (++gc->num_unsampled < DEVS_ALLOC_PROFILE_RATE || ctx->curr_fn == NULL)
+        return;
+    gc->num_unsampled = 0;
+    gc->num_seen++;
+    unsigned idx = gc->num_samples;
+    if (idx >= DEVS_ALLOC_PROFILE_SIZE) {
+        // reservoir sampling: every sample taken so far is equally likely to be in the table,
+        // so objects that live from startup don't keep out a site that starts leaking later
+        gc->num_dropped++;
+        idx = jd_random() % gc->num_seen;
+        if (idx >= DEVS_ALLOC_PROFILE_SIZE)
+            return;
+    } else {
+        gc->num_samples++;
+    }
+    alloc_sample_t *s = &gc->samples[idx];
+    s->block = block;
+    s->fn_idx = ctx->curr_fn->func - devs_img_get_function(ctx->img, 0);
+    s->pc = ctx->curr_fn->pc;
+}
+
+static void drop_sample(devs_gc_t *gc, block_t *block) {
+    for (unsigned i = 0; i < gc->num_samples; ++i)
+        if (gc->samples[i].block == block) {
+            gc->samples[i] = gc->samples[--gc->num_samples];
+            break;
+        }
+}
+
+unsigned devs_alloc_profile_snapshot(devs_ctx_t *ctx, const devs_alloc_site_t **sites,
+                                     uint32_t *num_dropped) {
+    devs_gc_t *gc = ctx->gc;
+    if (gc_in_cycle(gc))
+        devs_gc(gc, true); // this only finishes the current cycle
+    devs_gc(gc, true);
+
+    unsigned num_sites = 0;
+    for (unsigned i = 0; i < gc->num_samples; ++i) {
+        alloc_sample_t *s = &gc->samples[i];
+        devs_alloc_site_t *site = NULL;
+        for (unsigned j = 0; j < num_sites; ++j)
+            if (gc->sites[j].fn_idx == s->fn_idx && gc->sites[j].pc == s->pc) {
+                site = &gc->sites[j];
+                break;
+            }
+        if (site == NULL) {
+            site = &gc->sites[num_sites++];
+            site->fn_idx = s->fn_idx;
+            site->pc = s->pc;
+            site->count = 0;
+            site->bytes = 0;
+        }
+        site->count++;
+        site->bytes += block_size(s->block) * JD_PTRSIZE;
+    }
+
+    *sites = gc->sites;
+    *num_dropped = gc->num_dropped;
+    return num_sites;
+}
+#endif
+
 void *devs_any_try_alloc(devs_ctx_t *ctx, unsigned tag, unsigned size) {
     void *r = jd_gc_any_try_alloc(ctx->gc, tag, size);
     if (r == NULL)
         devs_oom(ctx, size);
+#if DEVS_ALLOC_PROFILE
+    else
+        sample_alloc(ctx, r);
+#endif
     return r;
 }
 
@@ -465,7 +1496,13 @@ void *devs_try_alloc(devs_ctx_t *ctx, uint32_t size) {
 static void unpin(devs_gc_t *gc, void *ptr, uint8_t tag) {
     JD_ASSERT(((uintptr_t)ptr & (JD_PTRSIZE - 1)) == 0);
     block_t *b = (block_t *)((uintptr_t *)ptr - 1);
-    JD_ASSERT(GET_TAG(b->header) == (DEVS_GC_TAG_MASK_PINNED | DEVS_GC_TAG_BYTES));
+    unsigned btag = GET_TAG(b->header);
+    // an incremental collection in progress may have marked it already; if so, it stays marked
+    // so that the sweep doesn't free it
+    JD_ASSERT((btag & ~DEVS_GC_TAG_MASK_SCANNED) ==
+              (DEVS_GC_TAG_MASK_PINNED | DEVS_GC_TAG_BYTES));
+    if (tag != DEVS_GC_TAG_FREE)
+        tag |= btag & DEVS_GC_TAG_MASK_SCANNED;
     mark_block(gc, b, tag, block_size(b));
 }
 
@@ -480,6 +1517,42 @@ void jd_gc_free(devs_gc_t *gc, void *ptr) {
         return;
     LOG("jd_gc_free %p", (uintptr_t *)ptr - 1);
     unpin(gc, ptr, DEVS_GC_TAG_FREE);
+#if DEVS_ALLOC_PROFILE
+    drop_sample(gc, (block_t *)((uintptr_t *)ptr - 1));
+#endif
+    block_t *b = (block_t *)((uintptr_t *)ptr - 1);
+#if DEVS_GC_GENERATIONAL
+    forget_young(gc, b);
+    // the next sweep of the nursery merges it back
+    if (in_nursery(gc, b))
+        return;
+#endif
+    // can be reused right away; it will be merged with its neighbours by the next sweep
+#if DEVS_GC_INCREMENTAL
+    // (unless a lazy sweep is yet to reach it; the sweep will pick it up then)
+    if (gc->state == GC_SWEEPING && !swept(gc, b))
+        return;
+#endif
+    push_free_block(gc, b);
+}
+
+bool devs_gc_try_free(devs_gc_t *gc, void *obj) {
+    // an incremental collection may have it on the mark stack, or not swept yet
+    if (gc_in_cycle(gc))
+        return false;
+    block_t *b = obj;
+    JD_ASSERT(!(GET_TAG(b->header) & DEVS_GC_TAG_MASK_PINNED));
+#if DEVS_ALLOC_PROFILE
+    drop_sample(gc, b);
+#endif
+    mark_block(gc, b, DEVS_GC_TAG_FREE, block_size(b));
+#if DEVS_GC_GENERATIONAL
+    forget_young(gc, b);
+    if (in_nursery(gc, b))
+        return true;
+#endif
+    push_free_block(gc, b);
+    return true;
 }
 
 bool devs_value_is_pinned(devs_ctx_t *ctx, value_t v) {
@@ -499,6 +1572,13 @@ void devs_value_pin(devs_ctx_t *ctx, value_t v) {
     JD_ASSERT((tag & DEVS_GC_TAG_MASK_PINNED) == 0);
     JD_ASSERT((tag & DEVS_GC_TAG_MASK) >= DEVS_GC_TAG_BYTES);
     b->header |= ((uintptr_t)DEVS_GC_TAG_MASK_PINNED << DEVS_GC_TAG_POS);
+    add_pinned(ctx->gc, b);
+#if DEVS_GC_INCREMENTAL
+    // same as for pinned allocations
+    if (ctx->gc->state == GC_MARKING &&
+        !(tag & (DEVS_GC_TAG_MASK_SCANNED | DEVS_GC_TAG_MASK_PENDING)))
+        gray_block(ctx->gc, b);
+#endif
 }
 
 void devs_value_unpin(devs_ctx_t *ctx, value_t v) {
@@ -509,6 +1589,7 @@ void devs_value_unpin(devs_ctx_t *ctx, value_t v) {
     JD_ASSERT((tag & DEVS_GC_TAG_MASK_PINNED) != 0);
     JD_ASSERT((tag & DEVS_GC_TAG_MASK) >= DEVS_GC_TAG_BYTES);
     b->header &= ~((uintptr_t)DEVS_GC_TAG_MASK_PINNED << DEVS_GC_TAG_POS);
+    remove_pinned(ctx->gc, b);
 }
 
 devs_map_t *devs_map_try_alloc(devs_ctx_t *ctx, devs_maplike_t *proto) {
@@ -536,14 +1617,18 @@ devs_array_t *devs_array_try_alloc(devs_ctx_t *ctx, unsigned size) {
         arr->data = devs_try_alloc(ctx, bytesize);
         if (arr->data == NULL) {
             arr->gc.header ^= (uintptr_t)DEVS_GC_TAG_MASK_PINNED << DEVS_GC_TAG_POS;
+            remove_pinned(ctx->gc, (block_t *)arr);
             return NULL;
         } else {
             // data now rooted in array
             jd_gc_unpin(ctx->gc, arr->data);
+            // the (pinned) array might have been promoted while allocating data
+            devs_gc_write_barrier(ctx, arr);
         }
         arr->length = arr->capacity = size;
     }
     arr->gc.header ^= (uintptr_t)DEVS_GC_TAG_MASK_PINNED << DEVS_GC_TAG_POS;
+    remove_pinned(ctx->gc, (block_t *)arr);
     return arr;
 }
 
@@ -648,6 +1733,20 @@ devs_any_string_t *devs_string_try_alloc_init(devs_ctx_t *ctx, const char *str,
 }
 
 void devs_gc_set_ctx(devs_gc_t *gc, devs_ctx_t *ctx) {
+#if DEVS_GC_INCREMENTAL
+    if (gc->state != GC_IDLE) {
+        // drop the collection started for the previous program
+        clear_marks(gc);
+        gc->mark_sp = 0;
+        gc->state = GC_IDLE;
+    }
+#endif
+#if DEVS_ALLOC_PROFILE
+    // function indices refer to the previous program
+    gc->num_samples = 0;
+    gc->num_seen = 0;
+    gc->num_dropped = 0;
+#endif
     gc->ctx = ctx;
 }
 
@@ -663,7 +1762,9 @@ static const char *tags[] = {
     "half_static_map", //
     "short_map",       //
     "packet",          //
-    "string_jmp"       //
+    "string_jmp",      //
+    "image",           //
+    "shape",           //
 };
 
 const char *devs_gc_tag_name(unsigned tag) {
@@ -779,6 +1880,10 @@ void devs_gc_obj_check(devs_ctx_t *ctx, const void *ptr) {
     devs_gc_obj_check_core(ctx->gc, ptr);
 }
 
+void devs_get_gc_stats(devs_ctx_t *ctx, devs_gc_stats_t *dst) {
+    *dst = ctx->gc->stats;
+}
+
 int devs_dump_heap(devs_ctx_t *ctx, int off, int cnt) {
     int curr = 0;
     int endoff = off + cnt;
@@ -796,6 +1901,8 @@ int devs_dump_heap(devs_ctx_t *ctx, int off, int cnt) {
                 break;
             JD_ASSERT(block < chunk->end);
 
+            tag = BASIC_TAG(header);
+
             if (off == -1) {
                 numobj++;
                 int sz = block_size(block) * sizeof(void *);
@@ -829,6 +1936,26 @@ int devs_dump_heap(devs_ctx_t *ctx, int off, int cnt) {
     if (off == -1) {
         JD_LOG("stats: %d objects, %d B used, %d B free (%d B max block)", numobj, used_size,
                free_size, max_free_block);
+        devs_gc_t *gc = ctx->gc;
+        devs_gc_stats_t *st = &gc->stats;
+        JD_LOG("gc: %u collections (%u full, %u compactions), pause %u us total, %u us max",
+               (unsigned)st->num_gc, (unsigned)st->num_full_gc, (unsigned)st->num_compactions,
+               (unsigned)st->total_pause_us, (unsigned)st->max_pause_us);
+        JD_LOG("gc: %u survivors (%u B), fragmentation %u/1000", (unsigned)st->survivors,
+               (unsigned)st->survivor_bytes, (unsigned)st->fragmentation);
+        for (unsigned t = 0; t < DEVS_GC_TAG_MASK; ++t)
+            if (st->alloc_bytes[t])
+                JD_LOG("alloc %s: %u B", devs_gc_tag_name(t), (unsigned)st->alloc_bytes[t]);
+        for (unsigned c = 0; c < GC_NUM_CLASSES; ++c) {
+            unsigned num_free = 0;
+            for (block_t *b = gc->free_lists[c]; b; b = b->free.next)
+                num_free++;
+            if (num_free == 0 && gc->class_hits[c] == 0 && gc->class_misses[c] == 0)
+                continue;
+            unsigned min_words = c < GC_SMALL_WORDS - 1 ? c + 2 : (GC_SMALL_WORDS << (c - 7)) + 1u;
+            JD_LOG("class %u+ words: %u free, %u hits, %u misses", min_words, num_free,
+                   (unsigned)gc->class_hits[c], (unsigned)gc->class_misses[c]);
+        }
     }
 
     return curr;
@@ -7,8 +7,10 @@ static void meth1_error_ctor(devs_ctx_t *ctx, unsigned blt, unsigned str) {
     devs_map_t *m = devs_arg_self_map(ctx);
     if (!m)
         return;
-    if (m->proto == NULL)
+    if (m->proto == NULL) {
         m->proto = devs_get_builtin_object(ctx, blt);
+        devs_gc_write_barrier(ctx, m);
+    }
     value_t msg = devs_arg(ctx, 0);
     if (devs_is_undefined(msg))
         msg = devs_builtin_string(str);
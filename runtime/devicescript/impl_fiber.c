@@ -22,6 +22,21 @@ value_t prop_DsFiber_suspended(devs_ctx_t *ctx, value_t self) {
     return fib ? devs_value_from_bool(fib->pkt_kind == DEVS_PKT_KIND_SUSPENDED) : devs_undefined;
 }
 
+value_t prop_DsFiber_steps(devs_ctx_t *ctx, value_t self) {
+    devs_fiber_t *fib = fiber_self(ctx, self);
+    return fib ? devs_value_from_double(fib->num_steps) : devs_undefined;
+}
+
+value_t prop_DsFiber_runTime(devs_ctx_t *ctx, value_t self) {
+    devs_fiber_t *fib = fiber_self(ctx, self);
+    return fib ? devs_value_from_double(fib->run_time / 1000.0) : devs_undefined;
+}
+
+value_t prop_DsFiber_quantum(devs_ctx_t *ctx, value_t self) {
+    devs_fiber_t *fib = fiber_self(ctx, self);
+    return fib ? devs_value_from_int(fib->quantum) : devs_undefined;
+}
+
 static devs_fiber_t *devs_arg_self_fiber(devs_ctx_t *ctx) {
     return fiber_self(ctx, devs_arg_self(ctx));
 }
@@ -39,6 +54,15 @@ void meth1_DsFiber_resume(devs_ctx_t *ctx) {
     devs_fiber_set_wake_time(fib, 1); // 1 is in the past
 }
 
+void meth1_DsFiber_setQuantum(devs_ctx_t *ctx) {
+    devs_fiber_t *fib = devs_arg_self_fiber(ctx);
+    if (!fib)
+        return;
+    int steps = devs_arg_int(ctx, 0);
+    // applies from the next time the fiber is resumed
+    fib->quantum = steps < 0 ? 0 : steps;
+}
+
 void meth0_DsFiber_terminate(devs_ctx_t *ctx) {
     devs_fiber_t *fib = devs_arg_self_fiber(ctx);
     if (!fib)
@@ -40,6 +40,7 @@ static devs_gimage_t *make_writable_image(devs_ctx_t *ctx, devs_gimage_t *r) {
         r->buffer = devs_buffer_try_alloc(ctx, r->stride * r->width);
         if (r->buffer == NULL)
             return NULL;
+        devs_gc_write_barrier(ctx, r);
         r->read_only = 0;
         uint8_t *pix = r->pix;
         r->pix = r->buffer->data;
@@ -149,6 +150,7 @@ void fun5_Image_alloc(devs_ctx_t *ctx) {
     r->read_only = buf == NULL;
     r->pix = pix;
     r->buffer = buf;
+    devs_gc_write_barrier(ctx, r);
 }
 
 static void setCore(devs_gimage_t *img, int x, int y, int c) {
@@ -372,6 +374,7 @@ static devs_gimage_t *alloc_img_ret(devs_ctx_t *ctx, int width, int height, int
         devs_ret(ctx, devs_undefined);
         return NULL;
     }
+    devs_gc_write_barrier(ctx, r);
 
     r->pix = r->buffer->data;
 
@@ -59,6 +59,8 @@ void fun2_Object_setPrototypeOf(devs_ctx_t *ctx) {
     }
 
     m->proto = p;
+    devs_gc_write_barrier(ctx, m);
+    devs_field_ic_invalidate(ctx);
 
     devs_ret(ctx, trg);
 }
@@ -7,6 +7,30 @@
 #define RESUME_USER_CODE 1
 #define KEEP_WAITING 0
 
+#define WAIT_HASH(role_idx, cmd) (((role_idx)*31 + (cmd)) & (DEVS_FIBER_HASH_SIZE - 1))
+
+#define ROLE_HASH(device_id)                                                                       \
+    (((uint32_t)(device_id) ^ (uint32_t)((device_id) >> 32)) & (DEVS_ROLE_HASH_SIZE - 1))
+
+// fibers are added at the end of their bucket, so they are woken up in the order they waited
+static void wait_link(devs_ctx_t *ctx, devs_fiber_t *fib) {
+    devs_fiber_t **p = &ctx->fibers_waiting[WAIT_HASH(fib->role_idx, fib->service_command)];
+    while (*p)
+        p = &(*p)->next_waiting;
+    *p = fib;
+    fib->next_waiting = NULL;
+    fib->waiting = 1;
+}
+
+static void wait_unlink(devs_ctx_t *ctx, devs_fiber_t *fib) {
+    devs_fiber_t **p = &ctx->fibers_waiting[WAIT_HASH(fib->role_idx, fib->service_command)];
+    while (*p != fib)
+        p = &(*p)->next_waiting;
+    *p = fib->next_waiting;
+    fib->next_waiting = NULL;
+    fib->waiting = 0;
+}
+
 static void devs_jd_setup_cached(devs_ctx_t *ctx, unsigned role_idx,
                                  devs_regcache_entry_t *cached) {
     jd_device_service_t *serv = devs_role_service(ctx, role_idx);
@@ -35,10 +59,12 @@ void devs_jd_get_register(devs_ctx_t *ctx, unsigned role_idx, unsigned code, uns
             if (cached->last_refresh_time + timeout < devs_now(ctx)) {
                 devs_regcache_free(&ctx->regcache, cached);
             } else {
+                ctx->regcache.num_hits++;
                 devs_jd_setup_cached(ctx, role_idx, cached);
                 return;
             }
         }
+        ctx->regcache.num_misses++;
     }
 
     devs_fiber_t *fib = ctx->curr_fiber;
@@ -48,17 +74,28 @@ void devs_jd_get_register(devs_ctx_t *ctx, unsigned role_idx, unsigned code, uns
     fib->pkt_kind = DEVS_PKT_KIND_REG_GET;
     fib->pkt_data.reg_get.string_idx = arg;
     fib->pkt_data.reg_get.resend_timeout = 20;
+    wait_link(ctx, fib);
 
     // DMESG("wait reg %x", code);
     devs_fiber_sleep(fib, 0);
 }
 
 void devs_jd_clear_pkt_kind(devs_fiber_t *fib) {
+    if (fib->waiting)
+        wait_unlink(fib->ctx, fib);
     switch (fib->pkt_kind) {
     case DEVS_PKT_KIND_SEND_PKT:
     case DEVS_PKT_KIND_SEND_RAW_PKT:
         devs_free(fib->ctx, fib->pkt_data.send_pkt.data);
         break;
+    case DEVS_PKT_KIND_AWAITING: {
+        devs_fiber_t **p = &fib->ctx->fibers_awaiting;
+        while (*p != fib)
+            p = &(*p)->next_awaiting;
+        *p = fib->next_awaiting;
+        fib->next_awaiting = NULL;
+        break;
+    }
     default:
         break;
     }
@@ -108,6 +145,7 @@ void devs_jd_send_cmd(devs_ctx_t *ctx, unsigned role_idx, unsigned code) {
         fib->pkt_data.send_pkt.size = sz;
         memcpy(fib->pkt_data.send_pkt.data, ctx->packet.data, sz);
     }
+    wait_link(ctx, fib);
     throttle_send_pkt(ctx, fib, 0);
 }
 
@@ -192,6 +230,7 @@ value_t devs_jd_pkt_capture(devs_ctx_t *ctx, unsigned role_idx) {
         devs_value_unpin(ctx, r);
         return devs_undefined;
     }
+    devs_gc_write_barrier(ctx, pkt);
     pkt->device_id = ctx->packet.device_identifier;
     pkt->service_index = ctx->packet.service_index;
     pkt->service_command = ctx->packet.service_command;
@@ -231,11 +270,15 @@ void devs_jd_wake_role(devs_ctx_t *ctx, unsigned role_idx, bool is_role_evt) {
 
     if (is_role_evt) {
         LOGV("role wake %d", role_idx);
-        for (devs_fiber_t *fiber = ctx->fibers; fiber; fiber = fiber->next) {
-            LOGV("scan %d %d %d %u", fiber->handle_tag, fiber->role_idx, fiber->pkt_kind,
-                 fiber->wake_time);
-            if (fiber->role_idx == role_idx)
-                devs_fiber_set_wake_time(fiber, devs_now(ctx));
+        // only fibers waiting for a packet have role_idx set
+        for (unsigned i = 0; i < DEVS_FIBER_HASH_SIZE; ++i) {
+            for (devs_fiber_t *fiber = ctx->fibers_waiting[i]; fiber;
+                 fiber = fiber->next_waiting) {
+                LOGV("scan %d %d %d %u", fiber->handle_tag, fiber->role_idx, fiber->pkt_kind,
+                     fiber->wake_time);
+                if (fiber->role_idx == role_idx)
+                    devs_fiber_set_wake_time(fiber, devs_now(ctx));
+            }
         }
     }
 }
@@ -274,10 +317,9 @@ static devs_regcache_entry_t *devs_jd_update_regcache(devs_ctx_t *ctx, unsigned
         q = NULL;
     }
 
-    if (!q) {
-        q = devs_regcache_alloc(&ctx->regcache, role_idx, pkt->service_command, resp_size);
-        q->argument = command_arg;
-    }
+    if (!q)
+        q = devs_regcache_alloc(&ctx->regcache, role_idx, pkt->service_command, command_arg,
+                                resp_size);
 
     memcpy(devs_regcache_data(q), dp, resp_size);
     q->last_refresh_time = devs_now(ctx);
@@ -418,15 +460,17 @@ static void devs_jd_update_all_regcache(devs_ctx_t *ctx, unsigned role_idx) {
 
     int num = 0;
 
-    for (devs_fiber_t *fiber = ctx->fibers; fiber; fiber = fiber->next) {
-        if (fiber->pkt_kind == DEVS_PKT_KIND_REG_GET && pkt->service_command &&
-            pkt->service_command == fiber->service_command &&
-            devs_jd_pkt_matches_role(ctx, fiber->role_idx)) {
+    devs_fiber_t *fiber = NULL;
+    if (pkt->service_command)
+        fiber = ctx->fibers_waiting[WAIT_HASH(role_idx, pkt->service_command)];
+    for (; fiber; fiber = fiber->next_waiting) {
+        if (fiber->pkt_kind == DEVS_PKT_KIND_REG_GET && fiber->role_idx == role_idx &&
+            pkt->service_command == fiber->service_command) {
             devs_regcache_entry_t *q =
                 devs_jd_update_regcache(ctx, fiber->role_idx, fiber->pkt_data.reg_get.string_idx);
             if (q) {
                 q = devs_regcache_mark_used(&ctx->regcache, q);
-                fiber->role_wkp = 1;
+                devs_fiber_role_wake(fiber);
                 num++;
             }
         }
@@ -445,6 +489,34 @@ static void devs_jd_update_all_regcache(devs_ctx_t *ctx, unsigned role_idx) {
     }
 }
 
+static void role_index_remove(devs_ctx_t *ctx, unsigned idx) {
+    devs_role_t *r = ctx->roles[idx];
+    if (!r->indexed)
+        return;
+    uint16_t *p = &ctx->roles_by_device[ROLE_HASH(r->device_id)];
+    while (*p != idx + 1)
+        p = &ctx->roles[*p - 1]->next_by_device;
+    *p = r->next_by_device;
+    r->next_by_device = 0;
+    r->indexed = 0;
+}
+
+// roles in a bucket are kept sorted by index, so packets are dispatched in role order
+static void role_index_update(devs_ctx_t *ctx, unsigned idx) {
+    role_index_remove(ctx, idx);
+    jd_device_service_t *serv = devs_role_service(ctx, idx);
+    if (serv == NULL)
+        return;
+    devs_role_t *r = ctx->roles[idx];
+    r->device_id = jd_service_parent(serv)->device_identifier;
+    uint16_t *p = &ctx->roles_by_device[ROLE_HASH(r->device_id)];
+    while (*p && *p < idx + 1)
+        p = &ctx->roles[*p - 1]->next_by_device;
+    r->next_by_device = *p;
+    *p = idx + 1;
+    r->indexed = 1;
+}
+
 void devs_jd_process_pkt(devs_ctx_t *ctx, jd_device_service_t *serv, jd_packet_t *pkt) {
     if (devs_is_suspended(ctx))
         return;
@@ -465,7 +537,9 @@ void devs_jd_process_pkt(devs_ctx_t *ctx, jd_device_service_t *serv, jd_packet_t
 
     // DMESG("pkt %d %x / %d", pkt->service_index, pkt->service_command, pkt->service_size);
 
-    for (unsigned idx = 0; idx < ctx->num_roles; ++idx) {
+    for (unsigned i = ctx->roles_by_device[ROLE_HASH(pkt->device_identifier)]; i;
+         i = ctx->roles[i - 1]->next_by_device) {
+        unsigned idx = i - 1;
         if (devs_jd_pkt_matches_role(ctx, idx)) {
             devs_fiber_sync_now(ctx);
             devs_jd_update_all_regcache(ctx, idx);
@@ -497,6 +571,7 @@ void devs_jd_role_changed(devs_ctx_t *ctx, jd_role_t *role) {
     for (unsigned idx = 0; idx < ctx->num_roles; ++idx) {
         devs_role_t *r = devs_role(ctx, idx);
         if (r && r->jdrole == role) {
+            role_index_update(ctx, idx);
             devs_regcache_free_role(&ctx->regcache, idx);
             devs_jd_reset_packet(ctx);
             devs_jd_wake_role(ctx, idx, true);
@@ -578,6 +653,7 @@ int devs_jd_alloc_role(devs_ctx_t *ctx, value_t name, uint32_t srv_class) {
     } else {
         r->name = name;
         ctx->roles[idx] = r;
+        role_index_update(ctx, idx); // in case it was bound right away
         ctx->flags |= DEVS_CTX_PENDING_ROLES;
         LOG("create role '%s' -> %d", n, idx);
     }
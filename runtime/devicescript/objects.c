@@ -11,6 +11,7 @@ void devs_map_clear(devs_ctx_t *ctx, devs_map_t *map) {
         map->capacity = 0;
         map->length = 0;
     }
+    map->shape = NULL;
 }
 
 static inline uint16_t *short_keys(devs_short_map_t *map) {
@@ -28,33 +29,117 @@ static value_t *lookup_short(devs_ctx_t *ctx, devs_short_map_t *map, uint16_t ke
     return NULL;
 }
 
-static value_t *lookup(devs_ctx_t *ctx, devs_map_t *map, value_t key) {
+// size of the hash index (in entries) kept after the key/value pairs in data[]
+// of a dictionary-mode map with the given capacity
+static unsigned hash_index_size(unsigned capacity) {
+#if DEVS_MAP_HASH_MIN_CAPACITY == 0
+    return 0;
+#else
+    if (capacity < DEVS_MAP_HASH_MIN_CAPACITY)
+        return 0;
+    unsigned sz = 32;
+    while (sz < capacity * 2)
+        sz <<= 1;
+    return sz;
+#endif
+}
+
+// entries are key index + 1, or 0 if empty
+static inline uint16_t *hash_index(devs_map_t *map) {
+    return (uint16_t *)(map->data + map->capacity * 2);
+}
+
+static void hash_insert(devs_ctx_t *ctx, devs_map_t *map, unsigned idx) {
+    unsigned mask = hash_index_size(map->capacity) - 1;
+    uint16_t *index = hash_index(map);
+    unsigned sz;
+    const char *p = devs_string_get_utf8(ctx, map->data[idx * 2], &sz);
+    unsigned h = jd_hash_fnv1a(p, sz) & mask;
+    while (index[h])
+        h = (h + 1) & mask;
+    index[h] = idx + 1;
+}
+
+static void hash_rebuild(devs_ctx_t *ctx, devs_map_t *map) {
+    unsigned sz = hash_index_size(map->capacity);
+    if (sz == 0)
+        return;
+    memset(hash_index(map), 0, sz * sizeof(uint16_t));
+    for (unsigned i = 0; i < map->length; ++i)
+        hash_insert(ctx, map, i);
+}
+
+static value_t *alloc_dict_data(devs_ctx_t *ctx, unsigned capacity) {
+    return devs_try_alloc(ctx, capacity * (2 * sizeof(value_t)) +
+                                   hash_index_size(capacity) * sizeof(uint16_t));
+}
+
+static int lookup_hashed(devs_ctx_t *ctx, devs_map_t *map, value_t key) {
+    unsigned mask = hash_index_size(map->capacity) - 1;
+    uint16_t *index = hash_index(map);
+    unsigned ksz, csz;
+    const char *cp, *kp = devs_string_get_utf8(ctx, key, &ksz);
+
+    // the index is at most half full, so this terminates
+    for (unsigned h = jd_hash_fnv1a(kp, ksz) & mask;; h = (h + 1) & mask) {
+        unsigned i = index[h];
+        if (i == 0)
+            return -1;
+        value_t k = map->data[(i - 1) * 2];
+        if (k.u64 == key.u64)
+            return i - 1;
+        cp = devs_string_get_utf8(ctx, k, &csz);
+        if (csz == ksz && memcmp(kp, cp, ksz) == 0)
+            return i - 1;
+    }
+}
+
+static int lookup_idx(devs_ctx_t *ctx, devs_map_t *map, value_t key) {
     if (!devs_is_string(ctx, key))
-        return NULL;
+        return -1;
+
+    if (!map->shape && hash_index_size(map->capacity))
+        return lookup_hashed(ctx, map, key);
+
+    value_t *data;
+    unsigned stride;
+    if (map->shape) {
+        data = map->shape->keys;
+        stride = 1;
+    } else {
+        data = map->data;
+        stride = 2;
+    }
 
-    value_t *data = map->data;
     uint32_t kh = devs_handle_value(key);
-    unsigned len2 = map->length * 2;
+    unsigned len = map->length * stride;
 
     // do a quick reference-only check
-    for (unsigned i = 0; i < len2; i += 2) {
+    for (unsigned i = 0; i < len; i += stride) {
         // check the low bits first, since they are more likely to be different
         if (devs_handle_value(data[i]) == kh && data[i].u64 == key.u64) {
-            return &data[i + 1];
+            return i / stride;
         }
     }
 
     // slow path - compare strings
     unsigned ksz, csz;
     const char *cp, *kp = devs_string_get_utf8(ctx, key, &ksz);
-    for (unsigned i = 0; i < len2; i += 2) {
+    for (unsigned i = 0; i < len; i += stride) {
         cp = devs_string_get_utf8(ctx, data[i], &csz);
         if (csz == ksz && memcmp(kp, cp, ksz) == 0)
-            return &data[i + 1];
+            return i / stride;
     }
 
     // nothing found...
-    return NULL;
+    return -1;
+}
+
+static value_t *lookup(devs_ctx_t *ctx, devs_map_t *map, value_t key) {
+    int idx = lookup_idx(ctx, map, key);
+    if (idx < 0)
+        return NULL;
+    return devs_map_value_ptr(map, idx);
 }
 
 static value_t proto_value(devs_ctx_t *ctx, const devs_builtin_proto_entry_t *p) {
@@ -86,10 +171,8 @@ unsigned devs_maplike_iter(devs_ctx_t *ctx, devs_maplike_t *src, void *userdata,
         unsigned len = srcmap->length;
 
         if (cb != NULL) {
-            unsigned len2 = srcmap->length * 2;
-            value_t *data = srcmap->data;
-            for (unsigned i = 0; i < len2; i += 2) {
-                cb(ctx, userdata, data[i], data[i + 1]);
+            for (unsigned i = 0; i < len; i++) {
+                cb(ctx, userdata, *devs_map_key_ptr(srcmap, i), *devs_map_value_ptr(srcmap, i));
             }
         }
 
@@ -136,8 +219,11 @@ void devs_maplike_keys_or_values(devs_ctx_t *ctx, devs_maplike_t *src, devs_arra
         return;
 
     devs_maplike_iter(ctx, src, &acc, kv_add);
+    devs_gc_write_barrier(ctx, arr);
 }
 
+static void field_ic_key_added(devs_ctx_t *ctx, value_t key);
+
 static int grow_len(int capacity) {
     int newlen = capacity * 10 / 8;
     if (newlen < 4)
@@ -145,10 +231,108 @@ static int grow_len(int capacity) {
     return newlen;
 }
 
+// switch map from shape to dictionary mode, making room for `capacity` entries
+static int map_to_dict(devs_ctx_t *ctx, devs_map_t *map, unsigned capacity) {
+    JD_ASSERT(map->shape != NULL);
+    JD_ASSERT(capacity >= map->length);
+
+    value_t *tmp = NULL;
+    if (capacity) {
+        tmp = alloc_dict_data(ctx, capacity);
+        if (!tmp)
+            return -1;
+        for (unsigned i = 0; i < map->length; ++i) {
+            tmp[i * 2] = map->shape->keys[i];
+            tmp[i * 2 + 1] = map->data[i];
+        }
+    }
+
+    map->data = tmp;
+    map->capacity = capacity;
+    map->shape = NULL;
+    if (tmp)
+        jd_gc_unpin(ctx->gc, tmp);
+    hash_rebuild(ctx, map);
+    devs_gc_write_barrier(ctx, map);
+    return 0;
+}
+
+static devs_shape_t *shape_add_key(devs_ctx_t *ctx, devs_shape_t *shape, value_t key) {
+    for (devs_shape_t *c = shape->first_child; c; c = c->next_sibling)
+        if (c->keys[c->length - 1].u64 == key.u64)
+            return c;
+
+    // only keys from the image, so that shapes don't keep dynamic strings alive
+    if (devs_handle_type(key) != DEVS_HANDLE_TYPE_IMG_BUFFERISH ||
+        shape->length >= DEVS_SHAPE_MAX_KEYS || ctx->num_shapes + 1 > DEVS_MAX_SHAPES)
+        return NULL;
+
+    unsigned len = shape->length + 1;
+    // no devs_oom() - we can always fall back to dictionary mode
+    devs_shape_t *c = jd_gc_any_try_alloc(ctx->gc, DEVS_GC_TAG_SHAPE,
+                                          sizeof(devs_shape_t) + len * sizeof(value_t));
+    if (!c)
+        return NULL;
+
+    c->length = len;
+    memcpy(c->keys, shape->keys, shape->length * sizeof(value_t));
+    c->keys[len - 1] = key;
+    c->next_sibling = shape->first_child;
+    shape->first_child = c;
+    devs_gc_write_barrier(ctx, shape);
+    ctx->num_shapes++;
+
+    return c;
+}
+
+void devs_map_use_shape(devs_ctx_t *ctx, devs_map_t *map) {
+    if (DEVS_MAX_SHAPES == 0 || map->length != 0)
+        return;
+
+    if (ctx->shape_root == NULL) {
+        ctx->shape_root = jd_gc_any_try_alloc(ctx->gc, DEVS_GC_TAG_SHAPE, sizeof(devs_shape_t));
+        if (ctx->shape_root == NULL)
+            return;
+    }
+
+    map->shape = ctx->shape_root;
+    devs_gc_write_barrier(ctx, map);
+}
+
+static void map_set_shaped(devs_ctx_t *ctx, devs_map_t *map, value_t key, value_t v) {
+    devs_shape_t *shape = shape_add_key(ctx, map->shape, key);
+    if (!shape) {
+        if (map_to_dict(ctx, map, grow_len(map->length)) == 0)
+            devs_map_set(ctx, map, key, v);
+        return;
+    }
+
+    if (map->capacity == map->length) {
+        int newlen = grow_len(map->capacity);
+        value_t *tmp = devs_try_alloc(ctx, newlen * sizeof(value_t));
+        if (!tmp)
+            return;
+        map->capacity = newlen;
+        if (map->length) {
+            memcpy(tmp, map->data, map->length * sizeof(value_t));
+        }
+        map->data = tmp;
+        jd_gc_unpin(ctx->gc, tmp);
+    }
+
+    map->data[map->length] = v;
+    map->length++;
+    map->shape = shape;
+    devs_gc_write_barrier(ctx, map);
+
+    field_ic_key_added(ctx, key);
+}
+
 void devs_map_set(devs_ctx_t *ctx, devs_map_t *map, value_t key, value_t v) {
     value_t *tmp = lookup(ctx, map, key);
     if (tmp != NULL) {
         *tmp = v;
+        devs_gc_write_barrier(ctx, map);
         return;
     }
 
@@ -159,9 +343,14 @@ void devs_map_set(devs_ctx_t *ctx, devs_map_t *map, value_t key, value_t v) {
 
     JD_ASSERT(map->capacity >= map->length);
 
+    if (map->shape) {
+        map_set_shaped(ctx, map, key, v);
+        return;
+    }
+
     if (map->capacity == map->length) {
         int newlen = grow_len(map->capacity);
-        tmp = devs_try_alloc(ctx, newlen * (2 * sizeof(value_t)));
+        tmp = alloc_dict_data(ctx, newlen);
         if (!tmp)
             return;
         map->capacity = newlen;
@@ -170,17 +359,24 @@ void devs_map_set(devs_ctx_t *ctx, devs_map_t *map, value_t key, value_t v) {
         }
         map->data = tmp;
         jd_gc_unpin(ctx->gc, tmp);
+        hash_rebuild(ctx, map);
     }
 
     map->data[map->length * 2] = key;
     map->data[map->length * 2 + 1] = v;
     map->length++;
+    if (hash_index_size(map->capacity))
+        hash_insert(ctx, map, map->length - 1);
+    devs_gc_write_barrier(ctx, map);
+
+    field_ic_key_added(ctx, key);
 }
 
 void devs_short_map_set(devs_ctx_t *ctx, devs_short_map_t *map, uint16_t key, value_t v) {
     value_t *tmp = lookup_short(ctx, map, key);
     if (tmp != NULL) {
         *tmp = v;
+        devs_gc_write_barrier(ctx, map);
         return;
     }
 
@@ -204,20 +400,24 @@ void devs_short_map_set(devs_ctx_t *ctx, devs_short_map_t *map, uint16_t key, va
     map->short_data[map->length] = v;
     short_keys(map)[map->length] = key;
     map->length++;
+    devs_gc_write_barrier(ctx, map);
 }
 
 int devs_map_delete(devs_ctx_t *ctx, devs_map_t *map, value_t key) {
-    value_t *tmp = lookup(ctx, map, key);
-    if (tmp == NULL) {
+    int idx = lookup_idx(ctx, map, key);
+    if (idx < 0) {
         return -1;
     }
 
-    tmp--;
-    unsigned off = tmp - map->data;
-    unsigned trailing = map->length - off / 2 - 1;
+    if (map->shape && map_to_dict(ctx, map, map->length) != 0)
+        return -1;
+
+    value_t *tmp = &map->data[idx * 2];
+    unsigned trailing = map->length - idx - 1;
     map->length--;
     if (trailing)
         memmove(tmp, tmp + 2, trailing * 2 * sizeof(value_t));
+    hash_rebuild(ctx, map);
     return 0;
 }
 
@@ -456,27 +656,32 @@ value_t devs_spec_lookup(devs_ctx_t *ctx, const devs_service_spec_t *spec, value
 static value_t devs_proto_lookup(devs_ctx_t *ctx, const devs_builtin_proto_t *proto, value_t key) {
     JD_ASSERT(devs_is_proto(proto));
 
-    while (proto) {
-        const devs_builtin_proto_entry_t *p = proto->entries;
+    // all entries are keyed by builtin strings, so anything else can't match
+    unsigned kidx;
+    if (devs_handle_type(key) == DEVS_HANDLE_TYPE_IMG_BUFFERISH &&
+        (devs_handle_value(key) >> DEVS_STRIDX__SHIFT) == DEVS_STRIDX_BUILTIN) {
+        kidx = devs_handle_value(key) & ((1 << DEVS_STRIDX__SHIFT) - 1);
+    } else {
+        unsigned ksz;
+        const char *kptr = devs_string_get_utf8(ctx, key, &ksz);
+        int r = devs_builtin_string_lookup(kptr, ksz);
+        // 0 is the empty string, which terminates the entries
+        if (r <= 0)
+            return devs_undefined;
+        kidx = r;
+    }
 
-        if (devs_handle_type(key) == DEVS_HANDLE_TYPE_IMG_BUFFERISH &&
-            (devs_handle_value(key) >> DEVS_STRIDX__SHIFT) == DEVS_STRIDX_BUILTIN) {
-            unsigned kidx = devs_handle_value(key) & ((1 << DEVS_STRIDX__SHIFT) - 1);
-            while (p->builtin_string_id) {
-                if (p->builtin_string_id == kidx)
-                    return proto_value(ctx, p);
-                p++;
-            }
+    while (proto) {
+        const devs_builtin_proto_hash_t *h =
+            &devs_builtin_proto_hashes[proto - devs_builtin_protos];
+        if (h->size) {
+            unsigned slot = h->slots[kidx % h->size];
+            if (slot != 0xff && proto->entries[slot].builtin_string_id == kidx)
+                return proto_value(ctx, &proto->entries[slot]);
         } else {
-            unsigned ksz;
-            const char *kptr = devs_string_get_utf8(ctx, key, &ksz);
-            if (ksz != strlen(kptr))
-                return devs_undefined;
-            while (p->builtin_string_id) {
-                if (strcmp(devs_builtin_string_by_idx(p->builtin_string_id), kptr) == 0)
+            for (const devs_builtin_proto_entry_t *p = proto->entries; p->builtin_string_id; p++)
+                if (p->builtin_string_id == kidx)
                     return proto_value(ctx, p);
-                p++;
-            }
         }
 
         proto = proto->parent;
@@ -521,8 +726,37 @@ static const devs_builtin_function_t *devs_get_property_desc(devs_ctx_t *ctx, va
 // if `fn` is a role member and `obj` is role, return (a different) `(obj, fn)` tuple
 // otherwise return `obj`
 // it may allocate an object for the tuple, but typically it doesn't
+#if DEVS_DEFER_METHOD_BIND
+// With ctx->defer_bind set, the VM is fetching a method that will end up in the_stack[0],
+// most likely to be called right away. Instead of allocating a bound function, the receiver
+// is kept on the side; the call uses it as 'this', and any other use of the_stack[0]
+// binds it with devs_bind_stack0().
+static value_t bind_alloc_or_defer(devs_ctx_t *ctx, value_t obj, value_t fn, bool defer) {
+    if (!defer)
+        return devs_function_bind_alloc(ctx, obj, fn);
+    ctx->stack0_this = obj;
+    ctx->stack0_unbound = 1;
+    return fn;
+}
+
+void devs_bind_stack0(devs_ctx_t *ctx) {
+    if (!ctx->stack0_unbound)
+        return;
+    value_t obj = ctx->stack0_this;
+    ctx->stack0_unbound = 0;
+    ctx->stack0_this = devs_undefined;
+    ctx->the_stack[0] = devs_function_bind_alloc(ctx, obj, ctx->the_stack[0]);
+}
+#else
+#define bind_alloc_or_defer(ctx, obj, fn, defer)                                                   \
+    ((void)(defer), devs_function_bind_alloc(ctx, obj, fn))
+#endif
+
 value_t devs_function_bind(devs_ctx_t *ctx, value_t obj, value_t fn) {
     int htp = devs_handle_type(fn);
+    // nested binds (eg. from property getters) are not for the_stack[0]
+    bool defer = ctx->defer_bind;
+    ctx->defer_bind = 0;
 
     if (htp == DEVS_HANDLE_TYPE_ROLE_MEMBER && devs_handle_type(obj) == DEVS_HANDLE_TYPE_ROLE &&
         !devs_value_to_service_spec(ctx, fn)) {
@@ -533,7 +767,7 @@ value_t devs_function_bind(devs_ctx_t *ctx, value_t obj, value_t fn) {
     }
 
     if (htp == DEVS_HANDLE_TYPE_CLOSURE)
-        return devs_function_bind_alloc(ctx, obj, fn);
+        return bind_alloc_or_defer(ctx, obj, fn, defer);
 
     if (htp != DEVS_HANDLE_TYPE_STATIC_FUNCTION)
         return fn;
@@ -567,11 +801,14 @@ value_t devs_function_bind(devs_ctx_t *ctx, value_t obj, value_t fn) {
                                           devs_handle_value(obj));
         }
 
-    return devs_function_bind_alloc(ctx, obj, fn);
+    return bind_alloc_or_defer(ctx, obj, fn, defer);
 }
 
 value_t devs_make_closure(devs_ctx_t *ctx, devs_activation_t *closure, unsigned fnidx) {
     JD_ASSERT(fnidx <= 0xffff);
+    // checked by devs_verify()
+    JD_ASSERT(!(closure->func->flags & DEVS_FUNCTIONFLAG_NO_CLOSURES));
+    closure->captured = 1;
     return devs_value_from_pointer(ctx, DEVS_HANDLE_TYPE_CLOSURE | (fnidx << 4), closure);
 }
 
@@ -850,6 +1087,7 @@ static devs_maplike_t *devs_object_get_attached(devs_ctx_t *ctx, value_t v, unsi
         map = *attached = devs_map_try_alloc(ctx, devs_get_builtin_object(ctx, builtin));
         if (map == NULL)
             return NULL;
+        devs_gc_write_barrier(ctx, obj);
     }
 
     if (map || (attach_flags & ATTACH_ENUM))
@@ -931,7 +1169,10 @@ bool devs_instance_of(devs_ctx_t *ctx, value_t obj, devs_maplike_t *cls_proto) {
     return false;
 }
 
-value_t devs_maplike_get_no_bind(devs_ctx_t *ctx, devs_maplike_t *proto, value_t key) {
+// if found, sets *holder to the object where the key was found, and *slot to the value
+// inside of it (or NULL when the value is computed from a static proto or spec)
+static value_t maplike_get_ex(devs_ctx_t *ctx, devs_maplike_t *proto, value_t key,
+                              devs_maplike_t **holder, value_t **slot) {
     value_t ptmp, *tmp = NULL;
 
     while (proto) {
@@ -962,15 +1203,170 @@ value_t devs_maplike_get_no_bind(devs_ctx_t *ctx, devs_maplike_t *proto, value_t
 
     if (tmp == NULL)
         return devs_undefined;
+    *holder = proto;
+    *slot = tmp == &ptmp ? NULL : tmp;
     return *tmp;
 }
 
+value_t devs_maplike_get_no_bind(devs_ctx_t *ctx, devs_maplike_t *proto, value_t key) {
+    devs_maplike_t *holder;
+    value_t *slot;
+    return maplike_get_ex(ctx, proto, key, &holder, &slot);
+}
+
 value_t devs_object_get(devs_ctx_t *ctx, value_t obj, value_t key) {
     ctx->diag_field = key;
     value_t tmp = devs_maplike_get_no_bind(ctx, devs_object_get_attached_ro(ctx, obj), key);
     return devs_function_bind(ctx, obj, tmp);
 }
 
+#if DEVS_FIELD_IC_SIZE
+
+// Bloom-filter bit for a key; has to depend only on the string content,
+// so that different handles to the same string map to the same bit.
+static uint32_t key_bit(devs_ctx_t *ctx, value_t key) {
+    unsigned sz;
+    const char *p = devs_string_get_utf8(ctx, key, &sz);
+    unsigned h = sz;
+    if (sz)
+        h = h * 31 + p[0] * 7 + p[sz - 1];
+    return 1U << (h & 31);
+}
+
+void devs_field_ic_invalidate(devs_ctx_t *ctx) {
+    ctx->field_ic_key_bloom = 0;
+    if (++ctx->field_ic_epoch == 0)
+        memset(ctx->field_ic, 0, sizeof(ctx->field_ic));
+}
+
+// called when a new key is added to any map
+static void field_ic_key_added(devs_ctx_t *ctx, value_t key) {
+    if (!ctx->field_ic_key_bloom && devs_handle_type(key) == DEVS_HANDLE_TYPE_IMG_BUFFERISH)
+        return;
+    uint32_t bit = key_bit(ctx, key);
+    // strings in the image are unique, but a computed string key might be equal to one of them
+    if (devs_handle_type(key) != DEVS_HANDLE_TYPE_IMG_BUFFERISH)
+        ctx->field_ic_dyn_key_bloom |= bit;
+    // the new key may shadow a cached inherited one
+    if (ctx->field_ic_key_bloom & bit)
+        devs_field_ic_invalidate(ctx);
+}
+
+static bool has_key_ref(devs_map_t *map, value_t key) {
+    for (unsigned i = 0; i < map->length; i++)
+        if (devs_map_key_ptr(map, i)->u64 == key.u64)
+            return true;
+    return false;
+}
+
+static bool get_slot(devs_map_t *map, unsigned idx, value_t key, value_t *res) {
+    if (idx >= map->length || devs_map_key_ptr(map, idx)->u64 != key.u64)
+        return false;
+    *res = *devs_map_value_ptr(map, idx);
+    return true;
+}
+
+static unsigned slot_idx(devs_maplike_t *map, value_t *slot) {
+    devs_map_t *m = (devs_map_t *)map;
+    return m->shape ? slot - m->data : (slot - m->data) / 2;
+}
+
+static bool field_ic_hit(devs_ctx_t *ctx, devs_field_ic_t *e, devs_maplike_t *start, value_t key,
+                         value_t *res) {
+    bool start_is_map = devs_is_map(start);
+
+    if (e->slot != DEVS_FIELD_IC_NO_SLOT && e->holder == NULL) {
+        // own property - no need to know the receiver, just check the key is still there
+        if (!start_is_map)
+            return false;
+        return get_slot((devs_map_t *)start, e->slot, key, res);
+    }
+
+    if (e->epoch != ctx->field_ic_epoch)
+        return false;
+
+    if (start_is_map) {
+        devs_map_t *map = (devs_map_t *)start;
+        if (map->proto != e->head || has_key_ref(map, key) ||
+            (ctx->field_ic_dyn_key_bloom & key_bit(ctx, key)))
+            return false;
+    } else if (start != e->head) {
+        return false;
+    }
+
+    if (e->slot == DEVS_FIELD_IC_NO_SLOT) {
+        *res = e->value;
+        return true;
+    }
+
+    return get_slot((devs_map_t *)e->holder, e->slot, key, res);
+}
+
+static void field_ic_fill(devs_ctx_t *ctx, devs_field_ic_t *e, devs_maplike_t *start, value_t key,
+                          devs_maplike_t *holder, value_t *slot, value_t v) {
+    if (holder == start) {
+        e->holder = NULL;
+        e->slot = slot_idx(start, slot);
+    } else {
+        if (slot) {
+            e->holder = holder;
+            e->slot = slot_idx(holder, slot);
+        } else {
+            e->holder = NULL;
+            e->slot = DEVS_FIELD_IC_NO_SLOT;
+            e->value = v;
+        }
+        e->head = devs_is_map(start) ? ((devs_map_t *)start)->proto : start;
+        e->epoch = ctx->field_ic_epoch;
+        ctx->field_ic_key_bloom |= key_bit(ctx, key);
+    }
+
+    e->pc = ctx->jmp_pc;
+}
+
+// like devs_object_get(), but caches where the key was found, keyed by current opcode PC
+value_t devs_object_get_cached(devs_ctx_t *ctx, value_t obj, value_t key) {
+    ctx->diag_field = key;
+    devs_maplike_t *start = devs_object_get_attached_ro(ctx, obj);
+    if (start == NULL)
+        return devs_function_bind(ctx, obj, devs_undefined);
+
+    unsigned pc = ctx->jmp_pc;
+    devs_field_ic_t *set =
+        &ctx->field_ic[(pc & (DEVS_FIELD_IC_SIZE / DEVS_FIELD_IC_WAYS - 1)) * DEVS_FIELD_IC_WAYS];
+    value_t v;
+
+    for (unsigned i = 0; i < DEVS_FIELD_IC_WAYS; ++i) {
+        if (set[i].pc == pc && field_ic_hit(ctx, &set[i], start, key, &v))
+            return devs_function_bind(ctx, obj, v);
+    }
+
+    devs_maplike_t *holder;
+    value_t *slot;
+    v = maplike_get_ex(ctx, start, key, &holder, &slot);
+
+    // static protos as receivers (eg. Math.foo) are not worth caching
+    if (!devs_is_undefined(v) && (holder != start || slot)) {
+        // keep the most recent entry first; this makes the cache polymorphic up to WAYS receivers
+        memmove(set + 1, set, (DEVS_FIELD_IC_WAYS - 1) * sizeof(*set));
+        field_ic_fill(ctx, set, start, key, holder, slot, v);
+    }
+
+    return devs_function_bind(ctx, obj, v);
+}
+
+#else
+
+void devs_field_ic_invalidate(devs_ctx_t *ctx) {}
+
+static void field_ic_key_added(devs_ctx_t *ctx, value_t key) {}
+
+value_t devs_object_get_cached(devs_ctx_t *ctx, value_t obj, value_t key) {
+    return devs_object_get(ctx, obj, key);
+}
+
+#endif
+
 value_t devs_object_get_built_in_field(devs_ctx_t *ctx, value_t obj, unsigned idx) {
     value_t key = devs_builtin_string(idx);
     ctx->diag_field = key;
@@ -1059,6 +1455,7 @@ static int array_ensure_len(devs_ctx_t *ctx, devs_array_t *arr, unsigned newlen)
         arr->data = newarr;
         arr->capacity = newlen;
         jd_gc_unpin(ctx->gc, newarr);
+        devs_gc_write_barrier(ctx, arr);
     }
     return 0;
 }
@@ -1072,6 +1469,7 @@ void devs_array_set(devs_ctx_t *ctx, devs_array_t *arr, unsigned idx, value_t v)
         arr->data[idx] = v;
         if (idx >= arr->length)
             arr->length = idx + 1;
+        devs_gc_write_barrier(ctx, arr);
     }
 }
 
@@ -1139,6 +1537,8 @@ int devs_array_insert(devs_ctx_t *ctx, devs_array_t *arr, unsigned idx, int coun
         memset(arr->data + idx, 0, count * sizeof(value_t));
     }
     arr->length = newlen;
+    // callers fill in the new elements directly
+    devs_gc_write_barrier(ctx, arr);
 
     return 0;
 }
@@ -0,0 +1,129 @@
+#include "devs_internal.h"
+
+// Sampling profiler for bytecode functions. Every sample records the chain of activations
+// (function indices only); identical chains share an entry, so the table is in effect
+// a call tree with sample counts at the leaves. It is printed in "folded stacks" format
+// (outermost frame first, separated by ';', followed by the count), which flame graph tools
+// read directly, and as a flat list with self and total counts per function.
+
+#if DEVS_CPU_PROFILE
+
+volatile sig_atomic_t devs_cpu_profile_ticked;
+
+void devs_cpu_profile_start(devs_ctx_t *ctx) {
+    if (ctx->cpu_profile)
+        return;
+    devs_cpu_profile_t *p = jd_alloc(sizeof(devs_cpu_profile_t));
+    p->steps = (devs_get_global_flags() & DEVS_FLAG_CPU_PROFILE_TIMER) ? 0 : DEVS_CPU_PROFILE_STEPS;
+    p->countdown = p->steps ? p->steps : UINT32_MAX;
+    devs_cpu_profile_ticked = 0;
+    ctx->cpu_profile = p;
+}
+
+void devs_cpu_profile_sample(devs_ctx_t *ctx) {
+    devs_cpu_profile_t *p = ctx->cpu_profile;
+    p->countdown = p->steps ? p->steps : UINT32_MAX;
+    devs_cpu_profile_ticked = 0;
+    p->num_samples++;
+
+    devs_cpu_stack_t s = {.count = 1};
+    for (devs_activation_t *fn = ctx->curr_fn; fn; fn = fn->caller) {
+        if (s.depth == DEVS_MAX_STACK_TRACE_FRAMES) {
+            s.truncated = 1;
+            break;
+        }
+        s.frames[s.depth++] = fn->func - devs_img_get_function(ctx->img, 0);
+    }
+
+    for (unsigned i = 0; i < p->num_stacks; ++i) {
+        devs_cpu_stack_t *e = &p->stacks[i];
+        if (e->depth == s.depth && e->truncated == s.truncated &&
+            memcmp(e->frames, s.frames, s.depth * sizeof(s.frames[0])) == 0) {
+            e->count++;
+            return;
+        }
+    }
+
+    if (p->num_stacks < DEVS_CPU_PROFILE_SIZE)
+        p->stacks[p->num_stacks++] = s;
+    else
+        p->num_dropped++;
+}
+
+void devs_cpu_profile_stop(devs_ctx_t *ctx) {
+    devs_cpu_profile_t *p = ctx->cpu_profile;
+    if (p == NULL)
+        return;
+    devs_cpu_profile_dump(ctx);
+    ctx->cpu_profile = NULL;
+    jd_free(p);
+}
+
+// only sets a flag, as the profile may be freed by the VM thread at any time
+void devs_cpu_profile_tick(void) {
+    devs_cpu_profile_ticked = 1;
+}
+
+static bool stack_has(devs_cpu_stack_t *s, unsigned fidx) {
+    for (unsigned i = 0; i < s->depth; ++i)
+        if (s->frames[i] == fidx)
+            return true;
+    return false;
+}
+
+void devs_cpu_profile_dump(devs_ctx_t *ctx) {
+    devs_cpu_profile_t *p = ctx->cpu_profile;
+    if (p == NULL)
+        return;
+
+    DMESG("cpu profile: %u samples, %u dropped", (unsigned)p->num_samples,
+          (unsigned)p->num_dropped);
+
+    char buf[DEVS_MAX_STACK_TRACE_FRAMES * 24 + 16];
+    for (unsigned i = 0; i < p->num_stacks; ++i) {
+        devs_cpu_stack_t *s = &p->stacks[i];
+        unsigned len = 0;
+        buf[0] = 0;
+        if (s->truncated) {
+            strcpy(buf, "...;");
+            len = 4;
+        }
+        for (int j = s->depth - 1; j >= 0; --j) {
+            unsigned fidx = s->frames[j];
+            jd_sprintf(buf + len, sizeof(buf) - len, "%s_F%d%s", devs_img_fun_name(ctx->img, fidx),
+                       fidx, j ? ";" : "");
+            len += strlen(buf + len);
+        }
+        DMESG("folded: %s %u", buf, (unsigned)s->count);
+    }
+
+    // each function is listed once, where it's first seen; stacks before that don't have it
+    for (unsigned i = 0; i < p->num_stacks; ++i) {
+        for (unsigned j = 0; j < p->stacks[i].depth; ++j) {
+            unsigned fidx = p->stacks[i].frames[j];
+            bool seen = false;
+            for (unsigned k = 0; k < i && !seen; ++k)
+                seen = stack_has(&p->stacks[k], fidx);
+            for (unsigned k = 0; k < j && !seen; ++k)
+                seen = p->stacks[i].frames[k] == fidx;
+            if (seen)
+                continue;
+            unsigned self = 0, total = 0;
+            for (unsigned k = i; k < p->num_stacks; ++k) {
+                if (p->stacks[k].depth && p->stacks[k].frames[0] == fidx)
+                    self += p->stacks[k].count;
+                if (stack_has(&p->stacks[k], fidx))
+                    total += p->stacks[k].count;
+            }
+            DMESG("flat: %s_F%d self %u total %u", devs_img_fun_name(ctx->img, fidx), fidx, self,
+                  total);
+        }
+    }
+}
+
+#else
+
+void devs_cpu_profile_tick(void) {}
+void devs_cpu_profile_dump(devs_ctx_t *ctx) {}
+
+#endif
@@ -1,90 +1,145 @@
 #include "devs_internal.h"
 
+#define ENTRY(cache, n) (&(cache)->entries[(n)-1])
+#define KEY_HASH(role_idx, cmd, arg)                                                               \
+    ((((role_idx)*31 + (cmd)) * 31 + (arg)) & (DEVS_REGCACHE_HASH_SIZE - 1))
+#define ROLE_HASH(role_idx) ((role_idx) & (DEVS_REGCACHE_ROLE_HASH_SIZE - 1))
+
+static unsigned entry_num(devs_regcache_t *cache, devs_regcache_entry_t *q) {
+    return q - cache->entries + 1;
+}
+
+static uint8_t *bucket_of(devs_regcache_t *cache, devs_regcache_entry_t *q) {
+    return &cache->buckets[KEY_HASH(q->role_idx, q->service_command, q->argument)];
+}
+
+static void lru_unlink(devs_regcache_t *cache, devs_regcache_entry_t *q) {
+    if (q->lru_prev)
+        ENTRY(cache, q->lru_prev)->lru_next = q->lru_next;
+    else
+        cache->lru_first = q->lru_next;
+    if (q->lru_next)
+        ENTRY(cache, q->lru_next)->lru_prev = q->lru_prev;
+    else
+        cache->lru_last = q->lru_prev;
+    q->lru_prev = q->lru_next = 0;
+}
+
+static void lru_push(devs_regcache_t *cache, devs_regcache_entry_t *q) {
+    unsigned n = entry_num(cache, q);
+    q->lru_prev = 0;
+    q->lru_next = cache->lru_first;
+    if (cache->lru_first)
+        ENTRY(cache, cache->lru_first)->lru_prev = n;
+    else
+        cache->lru_last = n;
+    cache->lru_first = n;
+}
+
 void devs_regcache_free(devs_regcache_t *cache, devs_regcache_entry_t *q) {
+    if (q->service_command == 0)
+        return;
+
+    unsigned n = entry_num(cache, q);
+    uint8_t *p = bucket_of(cache, q);
+    while (*p != n)
+        p = &ENTRY(cache, *p)->next_in_bucket;
+    *p = q->next_in_bucket;
+    p = &cache->by_role[ROLE_HASH(q->role_idx)];
+    while (*p != n)
+        p = &ENTRY(cache, *p)->next_by_role;
+    *p = q->next_by_role;
+    lru_unlink(cache, q);
+
     if (q->resp_size > DEVS_QUERY_MAX_INLINE)
         jd_free(q->value.buffer);
     q->resp_size = 0;
     q->service_command = 0;
+    q->next_by_role = 0;
+    q->next_in_bucket = cache->free_list;
+    cache->free_list = n;
 }
 
 void devs_regcache_free_all(devs_regcache_t *cache) {
-    for (unsigned i = 0; i < DEVS_REGCACHE_NUM_ENTRIES; ++i) {
-        devs_regcache_free(cache, &cache->entries[i]);
+    for (unsigned i = 0; i < cache->num_used; ++i) {
+        devs_regcache_entry_t *q = &cache->entries[i];
+        if (q->service_command && q->resp_size > DEVS_QUERY_MAX_INLINE)
+            jd_free(q->value.buffer);
     }
+    memset(cache, 0, sizeof(*cache));
 }
 
 devs_regcache_entry_t *devs_regcache_mark_used(devs_regcache_t *cache, devs_regcache_entry_t *q) {
-    unsigned idx = cache->latest_idx;
-    if (q == &cache->entries[idx])
-        return q; // already latest
-    idx++;
-    if (idx >= DEVS_REGCACHE_NUM_ENTRIES)
-        idx = 0;
-    if (q != &cache->entries[idx]) {
-        devs_regcache_entry_t tmp;
-        memcpy(&tmp, q, sizeof(tmp));
-        memcpy(q, &cache->entries[idx], sizeof(tmp));
-        memcpy(&cache->entries[idx], &tmp, sizeof(tmp));
+    if (cache->lru_first != entry_num(cache, q)) {
+        lru_unlink(cache, q);
+        lru_push(cache, q);
     }
-    cache->latest_idx = idx;
-    return &cache->entries[idx];
+    return q;
 }
 
 devs_regcache_entry_t *devs_regcache_alloc(devs_regcache_t *cache, unsigned role_idx,
-                                           unsigned service_command, unsigned resp_size) {
-    devs_regcache_entry_t *q = NULL;
-
+                                           unsigned service_command, unsigned argument,
+                                           unsigned resp_size) {
     JD_ASSERT(service_command > 0);
 
-    for (unsigned i = 0; i < DEVS_REGCACHE_NUM_ENTRIES; ++i) {
-        if (cache->entries[i].service_command == 0) {
-            q = &cache->entries[i];
-            break;
+    if (!cache->free_list) {
+        if (cache->num_used < DEVS_REGCACHE_NUM_ENTRIES) {
+            cache->free_list = ++cache->num_used;
+            ENTRY(cache, cache->free_list)->next_in_bucket = 0;
+        } else {
+            cache->num_evictions++;
+            devs_regcache_free(cache, ENTRY(cache, cache->lru_last));
         }
     }
 
-    if (!q) {
-        unsigned idx = cache->latest_idx + 1;
-        if (idx >= DEVS_REGCACHE_NUM_ENTRIES)
-            idx = 0;
-        q = &cache->entries[idx];
-        devs_regcache_free(cache, q);
-    }
+    unsigned n = cache->free_list;
+    devs_regcache_entry_t *q = ENTRY(cache, n);
+    cache->free_list = q->next_in_bucket;
 
     q->role_idx = role_idx;
     q->service_command = service_command;
-    q->argument = 0;
+    q->argument = argument;
     q->resp_size = resp_size;
     if (resp_size > DEVS_QUERY_MAX_INLINE)
         q->value.buffer = jd_alloc(resp_size);
 
-    q = devs_regcache_mark_used(cache, q);
+    uint8_t *p = bucket_of(cache, q);
+    q->next_in_bucket = *p;
+    *p = n;
+    p = &cache->by_role[ROLE_HASH(role_idx)];
+    q->next_by_role = *p;
+    *p = n;
+    lru_push(cache, q);
 
     return q;
 }
 
 devs_regcache_entry_t *devs_regcache_lookup(devs_regcache_t *cache, unsigned role_idx,
                                             unsigned service_command, unsigned argument) {
-    for (unsigned i = 0; i < DEVS_REGCACHE_NUM_ENTRIES; ++i) {
-        devs_regcache_entry_t *q = &cache->entries[i];
+    unsigned n = cache->buckets[KEY_HASH(role_idx, service_command, argument)];
+    while (n) {
+        devs_regcache_entry_t *q = ENTRY(cache, n);
         if (q->role_idx == role_idx && q->service_command == service_command &&
             q->argument == argument)
             return q;
+        n = q->next_in_bucket;
     }
     return NULL;
 }
 
 void devs_regcache_age(devs_regcache_t *cache, unsigned role_idx, uint32_t min_time) {
-    for (unsigned i = 0; i < DEVS_REGCACHE_NUM_ENTRIES; ++i) {
-        devs_regcache_entry_t *q = &cache->entries[i];
+    for (unsigned n = cache->by_role[ROLE_HASH(role_idx)]; n; n = ENTRY(cache, n)->next_by_role) {
+        devs_regcache_entry_t *q = ENTRY(cache, n);
         if (q->role_idx == role_idx && q->last_refresh_time > min_time)
             q->last_refresh_time = min_time;
     }
 }
 
 void devs_regcache_free_role(devs_regcache_t *cache, unsigned role_idx) {
-    for (unsigned i = 0; i < DEVS_REGCACHE_NUM_ENTRIES; ++i) {
-        devs_regcache_entry_t *q = &cache->entries[i];
+    unsigned n = cache->by_role[ROLE_HASH(role_idx)];
+    while (n) {
+        devs_regcache_entry_t *q = ENTRY(cache, n);
+        n = q->next_by_role;
         if (q->role_idx == role_idx)
             devs_regcache_free(cache, q);
     }
@@ -94,13 +149,12 @@ devs_regcache_entry_t *devs_regcache_next(devs_regcache_t *cache, unsigned role_
                                           unsigned service_command, devs_regcache_entry_t *prev) {
     if (!service_command)
         return NULL;
-    devs_regcache_entry_t *end = &cache->entries[DEVS_REGCACHE_NUM_ENTRIES];
-    if (!prev)
-        prev = &cache->entries[0];
-    while (prev < end) {
-        if (prev->service_command == service_command && prev->role_idx == role_idx)
-            return prev;
-        prev++;
+    unsigned n = prev ? prev->next_by_role : cache->by_role[ROLE_HASH(role_idx)];
+    while (n) {
+        devs_regcache_entry_t *q = ENTRY(cache, n);
+        if (q->service_command == service_command && q->role_idx == role_idx)
+            return q;
+        n = q->next_by_role;
     }
     return NULL;
-}
\ No newline at end of file
+}
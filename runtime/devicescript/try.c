@@ -247,6 +247,8 @@ void devs_process_throw(devs_ctx_t *ctx) {
     }
 
     ctx->stack_top = 0;
+    ctx->stack0_unbound = 0;
+    ctx->stack0_this = devs_undefined;
     ctx->in_throw = 0;
     if (ctx->curr_fiber)
         ctx->curr_fiber->ret_val = ctx->exn_val;
@@ -13,7 +13,7 @@ static int fail(int code, uint32_t offset) {
     return -code;
 }
 
-// next error 1087
+// next error 1092
 #define CHECK(code, cond)                                                                          \
     if (!(cond))                                                                                   \
     return fail(code, offset)
@@ -68,6 +68,42 @@ void devs_dump_versions(const void *imgdata) {
 
 STATIC_ASSERT(sizeof(devs_utf8_string_t) == offsetof(devs_utf8_string_t, jmp_table));
 
+// opcodes past this one were added in 2.12.0 (fused ops)
+#define FIRST_2_12_OP DEVS_STMTx2_ADD_STORE_LOCAL
+
+static int verify_code(const uint8_t *imgdata, const devs_img_header_t *header,
+                       const devs_function_desc_t *fptr) {
+    uint32_t offset = fptr->start;
+    uint32_t endp = fptr->start + fptr->length;
+    while (offset < endp) {
+        uint8_t op = imgdata[offset];
+        if (op == 0) {
+            // alignment padding at the end
+            while (offset < endp) {
+                CHECK(1087, imgdata[offset] == 0);
+                offset++;
+            }
+            break;
+        }
+        offset++;
+        if (op >= DEVS_DIRECT_CONST_OP)
+            continue;
+        CHECK(1088, op < DEVS_OP_PAST_LAST);
+        if (op >= FIRST_2_12_OP)
+            CHECK(1089, DEVS_VERSION_MINOR(header->version) >= 12);
+        if (op == DEVS_EXPRx_MAKE_CLOSURE)
+            CHECK(1091, !(fptr->flags & DEVS_FUNCTIONFLAG_NO_CLOSURES));
+        if (DEVS_OP_PROPS[op] & DEVS_BYTECODEFLAG_TAKES_NUMBER) {
+            CHECK(1090, offset < endp);
+            uint8_t v = imgdata[offset++];
+            if (v >= DEVS_FIRST_MULTIBYTE_INT)
+                offset += (v & 3) + 1;
+            CHECK(1090, offset <= endp);
+        }
+    }
+    return 0;
+}
+
 int devs_verify(const uint8_t *imgdata, uint32_t size) {
     JD_ASSERT(((uintptr_t)imgdata & 3) == 0);
     JD_ASSERT(size > sizeof(devs_img_header_t));
@@ -138,6 +174,9 @@ int devs_verify(const uint8_t *imgdata, uint32_t size) {
         if (fptr->flags & DEVS_FUNCTIONFLAG_HAS_REST_ARG)
             numargs--;
         CHECK(1076, numargs >= 0);
+        int r = verify_code(imgdata, header, fptr);
+        if (r)
+            return r;
     }
 
     const uint8_t *str_data = FIRST_DESC(string_data);
@@ -1,41 +1,105 @@
 #include "devs_internal.h"
 #include "devs_vm_internal.h"
 
-static inline uint8_t devs_vm_fetch_byte(devs_activation_t *frame, devs_ctx_t *ctx) {
-    if (frame->pc < frame->maxpc)
-        return ctx->img.data[frame->pc++];
-    devs_invalid_program(ctx, 60100);
-    return 0;
-}
-
 uint8_t devs_fetch_opcode(devs_activation_t *frame, devs_ctx_t *ctx) {
     return devs_vm_fetch_byte(frame, ctx);
 }
 
-static inline int32_t devs_vm_fetch_int(devs_activation_t *frame, devs_ctx_t *ctx) {
-    uint8_t v = devs_vm_fetch_byte(frame, ctx);
-    if (v < DEVS_FIRST_MULTIBYTE_INT)
-        return v;
-
-    int32_t r = 0;
-    bool n = !!(v & 4);
-    int len = (v & 3) + 1;
-    for (int i = 0; i < len; ++i) {
-        uint8_t b = devs_vm_fetch_byte(frame, ctx);
-        r <<= 8;
-        r |= b;
-    }
+#if DEVS_OP_STATS
+#define OP_STATS_CONST DEVS_OP_PAST_LAST // all direct constants
+#define OP_STATS_NUM_OPS (DEVS_OP_PAST_LAST + 1)
+
+#define KIND_NONE 0
+#define KIND_INT 1
+#define KIND_FLOAT 2
+#define KIND_SPECIAL 3 // undefined, null, booleans etc.
+#define KIND_OBJECT 4  // GC objects
+#define KIND_HANDLE 5  // roles, static functions, image buffers etc.
+#define NUM_KINDS 6
+
+static const char *kind_names[NUM_KINDS] = {"-", "int", "float", "special", "object", "handle"};
+
+// kept across programs, so that the numbers from a whole test run can be looked at together
+static struct {
+    uint32_t count[OP_STATS_NUM_OPS][NUM_KINDS][NUM_KINDS];
+#ifdef DEVS_OP_STATS_CYCLES
+    uint64_t cycles[OP_STATS_NUM_OPS];
+    uint64_t last_time; // when last_op started, 0 if outside of the VM loop
+    uint8_t last_op;
+#endif
+} op_stats;
+
+static unsigned operand_kind(value_t v) {
+    if (devs_is_tagged_int(v))
+        return KIND_INT;
+    int tp = devs_handle_type(v);
+    if (tp == DEVS_HANDLE_TYPE_FLOAT64)
+        return KIND_FLOAT;
+    if (tp == DEVS_HANDLE_TYPE_SPECIAL)
+        return KIND_SPECIAL;
+    return devs_handle_type_is_ptr(tp) ? KIND_OBJECT : KIND_HANDLE;
+}
 
-    return n ? -r : r;
+static void op_stats_leave(void) {
+#ifdef DEVS_OP_STATS_CYCLES
+    if (op_stats.last_time)
+        op_stats.cycles[op_stats.last_op] += DEVS_OP_STATS_CYCLES() - op_stats.last_time;
+    op_stats.last_time = 0;
+#endif
 }
 
-static inline void devs_vm_push(devs_ctx_t *ctx, value_t v) {
-    if (ctx->stack_top >= DEVS_MAX_STACK_DEPTH)
-        devs_invalid_program(ctx, 60101);
-    else
-        ctx->the_stack[ctx->stack_top++] = v;
+// called with the operands still on the stack
+void devs_vm_op_stats_enter(devs_ctx_t *ctx, unsigned op) {
+    unsigned a = KIND_NONE, b = KIND_NONE;
+    if (op >= DEVS_DIRECT_CONST_OP) {
+        op = OP_STATS_CONST;
+    } else if (op < DEVS_OP_PAST_LAST) {
+        unsigned n = DEVS_OP_PROPS[op] & DEVS_BYTECODEFLAG_NUM_ARGS_MASK;
+        if (n > ctx->stack_top)
+            n = ctx->stack_top; // the handler will complain
+        if (n >= 1)
+            a = operand_kind(ctx->the_stack[ctx->stack_top - n]);
+        if (n >= 2)
+            b = operand_kind(ctx->the_stack[ctx->stack_top - n + 1]);
+    } else {
+        return;
+    }
+    op_stats.count[op][a][b]++;
+#ifdef DEVS_OP_STATS_CYCLES
+    op_stats_leave();
+    op_stats.last_op = op;
+    op_stats.last_time = DEVS_OP_STATS_CYCLES();
+#endif
 }
 
+void devs_vm_dump_op_stats(void) {
+    for (unsigned op = 0; op < OP_STATS_NUM_OPS; ++op) {
+        uint32_t total = 0;
+        for (unsigned a = 0; a < NUM_KINDS; ++a)
+            for (unsigned b = 0; b < NUM_KINDS; ++b)
+                total += op_stats.count[op][a][b];
+        if (total == 0)
+            continue;
+#ifdef DEVS_OP_STATS_CYCLES
+        DMESG("op %u: %u times, %u cycles avg", op, (unsigned)total,
+              (unsigned)(op_stats.cycles[op] / total));
+#else
+        DMESG("op %u: %u times", op, (unsigned)total);
+#endif
+        if (op == OP_STATS_CONST || (DEVS_OP_PROPS[op] & DEVS_BYTECODEFLAG_NUM_ARGS_MASK) == 0)
+            continue;
+        for (unsigned a = 0; a < NUM_KINDS; ++a)
+            for (unsigned b = 0; b < NUM_KINDS; ++b)
+                if (op_stats.count[op][a][b])
+                    DMESG("op %u (%s, %s): %u times", op, kind_names[a], kind_names[b],
+                          (unsigned)op_stats.count[op][a][b]);
+    }
+}
+#else
+static inline void op_stats_leave(void) {}
+void devs_vm_dump_op_stats(void) {}
+#endif
+
 void devs_dump_stackframe(devs_ctx_t *ctx, devs_activation_t *fn) {
     int idx = fn->func - devs_img_get_function(ctx->img, 0);
     DMESG("at %s_F%d (pc:%d) st=%d", devs_img_fun_name(ctx->img, idx), idx,
@@ -60,16 +124,12 @@ void devs_vm_set_debug(devs_ctx_t *ctx, bool en) {
         devs_vm_resume(ctx);
 }
 
-static inline unsigned brk_hash(unsigned pc) {
-    return pc & (DEVS_BRK_HASH_SIZE - 1);
-}
-
 static void recompute_brk_jump_tbl(devs_ctx_t *ctx) {
     memset(ctx->brk_jump_tbl, 0, DEVS_BRK_HASH_SIZE);
     devs_brk_t *l = ctx->brk_list;
     for (unsigned i = 0; i < ctx->brk_count; ++i) {
-        if (l[i].pc && !ctx->brk_jump_tbl[brk_hash(l[i].pc)])
-            ctx->brk_jump_tbl[brk_hash(l[i].pc)] = i + 1;
+        if (l[i].pc && !ctx->brk_jump_tbl[devs_vm_brk_hash(l[i].pc)])
+            ctx->brk_jump_tbl[devs_vm_brk_hash(l[i].pc)] = i + 1;
     }
 }
 
@@ -152,7 +212,7 @@ int devs_vm_set_breakpoint(devs_ctx_t *ctx, unsigned pc, unsigned flags) {
 
     bool was_in_section = false;
     for (unsigned i = 0; i < cnt; ++i) {
-        bool in_section = brk_hash(l[i].pc) == brk_hash(pc);
+        bool in_section = devs_vm_brk_hash(l[i].pc) == devs_vm_brk_hash(pc);
         if (l[i].pc == 0) {
             l[i].pc = pc;
             l[i].flags = flags;
@@ -172,45 +232,26 @@ int devs_vm_set_breakpoint(devs_ctx_t *ctx, unsigned pc, unsigned flags) {
     return 1;
 }
 
-static inline bool devs_vm_chk_brk(devs_ctx_t *ctx, devs_activation_t *frame) {
-    if (ctx->dbg_en) {
-        if (ctx->ignore_brk) {
-            ctx->ignore_brk = false;
-            return false;
-        }
-
-        devs_pc_t pc = frame->pc;
-        unsigned i = ctx->brk_jump_tbl[brk_hash(pc)];
-
-        if (i) {
-            devs_brk_t *l = ctx->brk_list;
-            for (--i; pc >= l[i].pc; ++i) {
-                if (pc == l[i].pc) {
-                    if (l[i].flags & DEVS_BRK_FLAG_STEP) {
-                        // DMESG("chk step %d %p %p", pc, frame, ctx->step_fn);
-                        if (frame == ctx->step_fn) {
-                            devs_vm_suspend(ctx, JD_DEVS_DBG_SUSPENSION_TYPE_STEP);
-                            return true;
-                        } else {
-                            continue;
-                        }
-                    } else {
-                        devs_vm_suspend(ctx, JD_DEVS_DBG_SUSPENSION_TYPE_BREAKPOINT);
-                        return true;
-                    }
-                }
-            }
-        }
-    }
-
-    return false;
-}
+#if !DEVS_VM_THREADED_DISPATCH
 
 static void devs_vm_exec_opcode(devs_ctx_t *ctx, devs_activation_t *frame) {
     if (devs_vm_chk_brk(ctx, frame))
         return;
 
-    uint8_t op = devs_vm_fetch_byte(frame, ctx);
+    devs_decoded_op_t *d = devs_vm_fetch_decoded(ctx, frame);
+    uint8_t op;
+    if (d) {
+        op = d->op;
+#if DEVS_QUICKEN
+        if (op == DEVS_QOP_INT || op == DEVS_QOP_GENERIC)
+            op = d->orig_op;
+#endif
+        frame->pc += d->size;
+    } else {
+        op = devs_vm_fetch_byte(frame, ctx);
+    }
+
+    devs_vm_op_stats_enter(ctx, op);
 
     if (op >= DEVS_DIRECT_CONST_OP) {
         int v = op - DEVS_DIRECT_CONST_OP - DEVS_DIRECT_CONST_OFFSET;
@@ -224,10 +265,26 @@ static void devs_vm_exec_opcode(devs_ctx_t *ctx, devs_activation_t *frame) {
         uint8_t flags = DEVS_OP_PROPS[op];
 
         if (flags & DEVS_BYTECODEFLAG_TAKES_NUMBER) {
-            ctx->jmp_pc = frame->pc - 1;
-            ctx->literal_int = devs_vm_fetch_int(frame, ctx);
+            if (d) {
+                ctx->jmp_pc = frame->pc - d->size;
+                ctx->literal_int = d->literal;
+            } else {
+                ctx->jmp_pc = frame->pc - 1;
+                ctx->literal_int = devs_vm_fetch_int(frame, ctx);
+            }
         }
 
+#if DEVS_QUICKEN
+        if (d && devs_vm_is_int_fast_op(op) && devs_vm_quick_op(ctx, frame, d))
+            return;
+        if (!d && devs_vm_is_int_fast_op(op) && devs_vm_exec_int_op(ctx, frame, op))
+            return;
+#elif DEVS_VM_INT_FAST_PATH
+        if (devs_vm_is_int_fast_op(op) && devs_vm_exec_int_op(ctx, frame, op))
+            return;
+#endif
+
+        devs_vm_use_stack0(ctx, op);
         ctx->stack_top_for_gc = ctx->stack_top;
 
         // devs_dump_stackframe(ctx, frame);
@@ -246,18 +303,33 @@ static void devs_vm_exec_opcode(devs_ctx_t *ctx, devs_activation_t *frame) {
     }
 }
 
-void devs_vm_exec_opcodes(devs_ctx_t *ctx) {
-    unsigned maxsteps = DEVS_MAX_STEPS;
+#endif
+
+unsigned devs_vm_exec_opcodes(devs_ctx_t *ctx, unsigned maxsteps) {
+    unsigned start = maxsteps;
+    unsigned quantum = ctx->curr_fiber ? ctx->curr_fiber->quantum : 0;
+    unsigned preempt_at = quantum && maxsteps > quantum ? maxsteps - quantum : 0;
 
     // halt applies on first instruction if nothing was running
     if (ctx->step_flags & DEVS_CTX_STEP_HALT)
         devs_vm_suspend(ctx, JD_DEVS_DBG_SUSPENSION_TYPE_HALT);
 
-    while (ctx->curr_fn && --maxsteps && !ctx->suspension)
+#if DEVS_VM_THREADED_DISPATCH
+    maxsteps = devs_vm_exec_threaded(ctx, maxsteps, preempt_at);
+#else
+    while (ctx->curr_fn && --maxsteps && !ctx->suspension) {
+        if (devs_vm_preempt(ctx, maxsteps, preempt_at))
+            break;
+        devs_cpu_profile_step(ctx);
         devs_vm_exec_opcode(ctx, ctx->curr_fn);
+    }
+#endif
+    op_stats_leave();
 
     if (maxsteps == 0)
         devs_panic(ctx, DEVS_PANIC_TIMEOUT);
+
+    return start - maxsteps;
 }
 
 bool devs_in_vm_loop(devs_ctx_t *ctx) {
@@ -272,6 +344,20 @@ const char *devs_builtin_string_by_idx(unsigned idx) {
     return builtin_strings[idx];
 }
 
+// FNV-1a; has to match scripts/ds-builtin-proto.js
+int devs_builtin_string_lookup(const char *str, unsigned len) {
+    uint32_t h = jd_hash_fnv1a(str, len);
+    uint32_t d = devs_builtin_string_disp[h % devs_builtin_string_hash_buckets];
+    unsigned idx =
+        devs_builtin_string_slots[(h + d * ((h >> 16) | 1)) % devs_builtin_string_hash_size];
+    if (idx > DEVS_BUILTIN_STRING___MAX)
+        return -1;
+    const char *r = builtin_strings[idx];
+    if (strlen(r) == len && memcmp(r, str, len) == 0)
+        return idx;
+    return -1;
+}
+
 const devs_utf8_string_t *devs_img_get_string_jmp(devs_img_t img, uint32_t idx) {
     JD_ASSERT(DEVS_UTF8_HEADER_SIZE == sizeof(uint32_t));
     unsigned off = ((const uint32_t *)(img.data + img.header->utf8_strings.start))[idx];
@@ -216,7 +216,8 @@ static void stmt1_store_ret_val(devs_activation_t *frame, devs_ctx_t *ctx) {
     ctx->curr_fiber->ret_val = v;
 }
 
-static value_t *lookup_clo_val(devs_activation_t *frame, devs_ctx_t *ctx) {
+static value_t *lookup_clo_val(devs_activation_t *frame, devs_ctx_t *ctx,
+                               devs_activation_t **owner) {
     int level = devs_vm_pop_arg_i32(ctx);
     unsigned off = ctx->literal_int;
 
@@ -227,19 +228,25 @@ static value_t *lookup_clo_val(devs_activation_t *frame, devs_ctx_t *ctx) {
     while (closure && level-- > 0)
         closure = closure->closure;
 
-    if (closure && off < closure->func->num_slots)
+    if (closure && off < closure->func->num_slots) {
+        *owner = closure;
         return &closure->slots[off];
+    }
 
     return NULL;
 }
 
 static void stmtx2_store_closure(devs_activation_t *frame, devs_ctx_t *ctx) {
     value_t v = devs_vm_pop_arg(ctx);
-    value_t *dst = lookup_clo_val(frame, ctx);
+    devs_activation_t *closure;
+    value_t *dst = lookup_clo_val(frame, ctx, &closure);
     if (dst == NULL)
         devs_invalid_program(ctx, 60112);
-    else
+    else {
         *dst = v;
+        // the closure might have returned already and be old
+        devs_gc_write_barrier(ctx, closure);
+    }
 }
 
 static void stmtx1_store_global(devs_activation_t *frame, devs_ctx_t *ctx) {
@@ -272,7 +279,8 @@ static value_t exprx_load_local(devs_activation_t *frame, devs_ctx_t *ctx) {
 }
 
 static value_t exprx1_load_closure(devs_activation_t *frame, devs_ctx_t *ctx) {
-    value_t *src = lookup_clo_val(frame, ctx);
+    devs_activation_t *closure;
+    value_t *src = lookup_clo_val(frame, ctx, &closure);
     if (src == NULL) {
         return devs_invalid_program(ctx, 60116);
     } else {
@@ -407,11 +415,20 @@ static inline value_t get_field_ex(devs_ctx_t *ctx, unsigned tp, value_t obj) {
     if (devs_is_undefined(fld))
         return devs_undefined;
     else
-        return devs_object_get(ctx, obj, fld);
+        return devs_object_get_cached(ctx, obj, fld);
 }
 
 static inline value_t get_field(devs_ctx_t *ctx, unsigned tp) {
-    return get_field_ex(ctx, tp, devs_vm_pop_arg(ctx));
+    value_t obj = devs_vm_pop_arg(ctx);
+#if DEVS_DEFER_METHOD_BIND
+    // the result goes to the_stack[0], where CALLn expects the function
+    ctx->defer_bind = ctx->stack_top == 0;
+    value_t r = get_field_ex(ctx, tp, obj);
+    ctx->defer_bind = 0;
+    return r;
+#else
+    return get_field_ex(ctx, tp, obj);
+#endif
 }
 
 static value_t exprx_static_buffer(devs_activation_t *frame, devs_ctx_t *ctx) {
@@ -757,4 +774,146 @@ static value_t expr2_lt(devs_activation_t *frame, devs_ctx_t *ctx) {
     return devs_value_from_bool(af < bf);
 }
 
+// fused opcodes; these save the dispatch and stack traffic of the second op
+
+static void stmtx2_add_store_local(devs_activation_t *frame, devs_ctx_t *ctx) {
+    unsigned off = ctx->literal_int;
+    value_t v = expr2_add(frame, ctx);
+    if (off >= frame->func->num_slots)
+        devs_invalid_program(ctx, 60111);
+    else
+        frame->slots[off] = v;
+}
+
+static void stmtx2_jmp_lt_z(devs_activation_t *frame, devs_ctx_t *ctx) {
+    bool cond;
+    if (exec2_and_check_int_or_force_double(frame, ctx))
+        cond = aa < bb;
+    else
+        cond = af < bf;
+    int pc = get_pc(frame, ctx);
+    if (pc && !cond)
+        frame->pc = pc;
+}
+
+#if DEVS_VM_THREADED_DISPATCH
+
+// Same semantics as the table-driven loop in vm_main.c, but every opcode has its own label,
+// where its handler is called directly (and usually inlined), so the only indirect branch is
+// the jump to the next opcode.
+
+#if DEVS_VM_INT_FAST_PATH
+#define DEVS_VM_TRY_INT(code)                                                                      \
+    if (devs_vm_is_int_fast_op(code) && devs_vm_exec_int_op(ctx, frame, code))                     \
+        goto next;
+#else
+#define DEVS_VM_TRY_INT(code)
+#endif
+
+#define DEVS_VM_RUN_STMT(name)                                                                     \
+    name(frame, ctx);                                                                              \
+    if (ctx->stack_top)                                                                            \
+        devs_invalid_program(ctx, 60103);
+#define DEVS_VM_RUN_EXPR(name) devs_vm_push(ctx, name(frame, ctx));
+
+// ops taking a number start at op_num_*, unless the literal was decoded already
+#define DEVS_VM_FETCH_0(name)
+#define DEVS_VM_FETCH_1(name)                                                                      \
+    op_num_##name : ctx->jmp_pc = frame->pc - 1;                                                   \
+    ctx->literal_int = devs_vm_fetch_int(frame, ctx);
+
+#define DEVS_VM_OP(code, name, kind, num)                                                          \
+    DEVS_VM_FETCH_##num(name) op_##name : DEVS_VM_TRY_INT(code) devs_vm_use_stack0(ctx, code);    \
+    ctx->stack_top_for_gc = ctx->stack_top;                                                        \
+    DEVS_VM_RUN_##kind(name) goto chk_throw;
+
+#define DEVS_VM_LABEL_0(name) &&op_##name
+#define DEVS_VM_LABEL_1(name) &&op_num_##name
+#define DEVS_VM_INIT(code, name, kind, num)                                                        \
+    dispatch[code] = DEVS_VM_LABEL_##num(name);                                                    \
+    dispatch_decoded[code] = &&op_##name;
+
+unsigned devs_vm_exec_threaded(devs_ctx_t *ctx, unsigned maxsteps, unsigned preempt_at) {
+    static const void *dispatch[256];
+    // used for pre-decoded opcodes, where the literal is already known
+    static const void *dispatch_decoded[256];
+#if DEVS_QUICKEN
+    // for quickened ops that need the handler after all
+    static const void *handlers[DEVS_OP_PAST_LAST];
+#endif
+
+    if (!dispatch[0]) {
+        for (unsigned op = 0; op < 256; ++op)
+            dispatch[op] = dispatch_decoded[op] = op >= DEVS_DIRECT_CONST_OP ? &&do_const
+                                                  : op >= DEVS_OP_PAST_LAST   ? &&do_invalid
+                                                                              : &&do_removed;
+        DEVS_OP_LIST(DEVS_VM_INIT)
+#if DEVS_QUICKEN
+        for (unsigned op = 0; op < 256; ++op) {
+            if (op < DEVS_OP_PAST_LAST)
+                handlers[op] = dispatch_decoded[op];
+            if (devs_vm_is_int_fast_op(op) || op == DEVS_QOP_INT || op == DEVS_QOP_GENERIC)
+                dispatch_decoded[op] = &&do_quick;
+        }
+#endif
+    }
+
+    devs_activation_t *frame;
+    devs_decoded_op_t *d;
+    uint8_t op;
+
+next:
+    if (!ctx->curr_fn || !--maxsteps || ctx->suspension)
+        return maxsteps;
+    if (devs_vm_preempt(ctx, maxsteps, preempt_at))
+        return maxsteps;
+    devs_cpu_profile_step(ctx);
+    frame = ctx->curr_fn;
+    if (devs_vm_chk_brk(ctx, frame))
+        goto next;
+    d = devs_vm_fetch_decoded(ctx, frame);
+    if (d) {
+        op = d->op;
+        ctx->jmp_pc = frame->pc;
+        ctx->literal_int = d->literal;
+        frame->pc += d->size;
+        devs_vm_op_stats_enter(ctx, op >= DEVS_QOP_INT && op < DEVS_DIRECT_CONST_OP ? d->orig_op
+                                                                                     : op);
+        goto *dispatch_decoded[op];
+    }
+    op = devs_vm_fetch_byte(frame, ctx);
+    devs_vm_op_stats_enter(ctx, op);
+    goto *dispatch[op];
+
+do_const:
+    devs_vm_push(ctx, devs_value_from_int(op - DEVS_DIRECT_CONST_OP - DEVS_DIRECT_CONST_OFFSET));
+    goto next;
+
+do_invalid:
+    devs_invalid_program(ctx, 60102);
+    goto next;
+
+do_removed:
+    expr_invalid(frame, ctx);
+    goto chk_throw;
+
+#if DEVS_QUICKEN
+do_quick:
+    if (devs_vm_quick_op(ctx, frame, d))
+        goto next;
+    goto *handlers[d->orig_op];
+#endif
+
+    DEVS_OP_LIST(DEVS_VM_OP)
+
+chk_throw:
+    if (ctx->in_throw)
+        devs_process_throw(ctx);
+    goto next;
+}
+
+#else
+
 const void *const devs_vm_op_handlers[DEVS_OP_PAST_LAST + 1] = {DEVS_OP_HANDLERS};
+
+#endif
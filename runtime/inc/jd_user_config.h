@@ -38,8 +38,12 @@ __attribute__((format(printf, 1, 2))) void app_dmesg(const char *format, ...);
 #define JD_LSTORE_FF 0
 #define JD_LSTORE_FILE_SIZE (4 * 1024 * 1024)
 #define JD_NET_BRIDGE 1
+#define DEVS_CPU_PROFILE 1
 #endif
 
+// time-slice busy fibers, so the fiber scheduling is exercised by tests
+#define DEVS_FIBER_QUANTUM 20000
+
 // disable reset_in packets - not too useful on servers
 #define JD_CONFIG_WATCHDOG 0
 
@@ -5,6 +5,8 @@
 #include <errno.h>
 #include <pthread.h>
 #include <assert.h>
+#include <signal.h>
+#include <sys/time.h>
 
 #include "jd_sdk.h"
 #include "devicescript.h"
@@ -242,6 +244,7 @@ static void run_sample(const char *name, int keepgoing) {
     }
 
     LOG("terminating program");
+    devs_vm_dump_op_stats();
 
     devsmgr_deploy(NULL, 0);
     jd_lstore_force_flush();
@@ -251,6 +254,17 @@ static void run_sample(const char *name, int keepgoing) {
 static jd_transport_ctx_t *transport_ctx = NULL;
 extern int settings_in_files;
 
+static void profile_tick(int sig) {
+    devs_cpu_profile_tick();
+}
+
+// sample every 1ms of CPU time used by the process
+static void start_profile_timer(void) {
+    signal(SIGPROF, profile_tick);
+    struct itimerval tv = {.it_interval = {.tv_usec = 1000}, .it_value = {.tv_usec = 1000}};
+    setitimer(ITIMER_PROF, &tv, NULL);
+}
+
 
 int main(int argc, const char **argv) {
     const jd_transport_t *transport = NULL;
@@ -290,6 +304,9 @@ int main(int argc, const char **argv) {
             enable_lstore = 1;
         } else if (strcmp(arg, "-X") == 0) {
             devs_set_global_flags(DEVS_FLAG_GC_STRESS);
+        } else if (strcmp(arg, "-P") == 0) {
+            devs_set_global_flags(DEVS_FLAG_CPU_PROFILE | DEVS_FLAG_CPU_PROFILE_TIMER);
+            start_profile_timer();
         } else if (strcmp(arg, "-w") == 0) {
             websock = 1;
         } else if (strcmp(arg, "-n") == 0) {
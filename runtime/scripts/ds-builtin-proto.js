@@ -31,6 +31,26 @@ bytecodedef.replace(/^#define (DEVS_BUILTIN_OBJECT_\w+)/gm, (_, key) => {
 delete builtinObjects["DEVS_BUILTIN_OBJECT___MAX"]
 delete builtinObjects["DEVS_BUILTIN_OBJECT__VAL"]
 
+const builtinStringIds = {}
+bytecodedef.replace(
+    /^#define DEVS_BUILTIN_STRING_(\w+) (\d+)/gm,
+    (_, key, v) => {
+        builtinStringIds[key] = +v
+        return ""
+    }
+)
+const builtinStrings = []
+bytecodedef.replace(
+    /^#define DEVS_BUILTIN_STRING__VAL((.*\\\r?\n)*.*)/m,
+    (_, vals) => {
+        vals.replace(/"(\\.|[^"\\])*"/g, s => {
+            builtinStrings.push(JSON.parse(s))
+            return ""
+        })
+        return ""
+    }
+)
+
 const deriveMap = {}
 
 let maxParms = 0
@@ -223,6 +243,35 @@ for (const k of Object.keys(byObj)) {
 }
 delete byObj["empty"]
 
+// for every prototype, find smallest table where (string_id % size) doesn't collide
+const hashedObjs = []
+for (const k of Object.keys(byObj)) {
+    const ids = byObj[k].map(ent => {
+        const m = /N\((\w+)\)/.exec(ent)
+        if (!m || builtinStringIds[m[1]] === undefined)
+            throw new Error(`unknown builtin string in ${ent}`)
+        return builtinStringIds[m[1]]
+    })
+    if (ids.length == 0 || ids.length > 0xfe) continue
+    for (let size = ids.length; size <= 0xff; ++size) {
+        const slots = []
+        for (let i = 0; i < size; ++i) slots.push(0xff)
+        let ok = true
+        ids.forEach((id, i) => {
+            const slot = id % size
+            // a duplicate key is shadowed by the first entry, as in a linear scan
+            if (slots[slot] != 0xff && ids[slots[slot]] != id) ok = false
+            else if (slots[slot] == 0xff) slots[slot] = i
+        })
+        if (ok) {
+            r += `static const uint8_t ${k}_hash[${size}] = { ${slots.join(", ")} };\n`
+            hashedObjs.push(k)
+            break
+        }
+    }
+}
+r += "\n"
+
 r += `const devs_builtin_proto_t devs_builtin_protos[DEVS_BUILTIN_OBJECT___MAX + 1] = {\n`
 for (const k of Object.keys(byObj)) {
     const base = deriveMap[k]
@@ -244,6 +293,14 @@ for (const key of Object.keys(builtinObjects)) {
 
 r += "};\n\n"
 
+r += `const devs_builtin_proto_hash_t devs_builtin_proto_hashes[DEVS_BUILTIN_OBJECT___MAX + 1] = {\n`
+for (const k of hashedObjs) {
+    r += `[${objKey(k)}] = { ${k}_hash, sizeof(${k}_hash) },\n`
+}
+r += "};\n\n"
+
+r += builtinStringHash()
+
 r += `uint16_t devs_num_builtin_functions = ${allfuns.length};\n`
 r += `const devs_builtin_function_t devs_builtin_functions[${allfuns.length}] = {\n`
 r += allfuns.join(",\n")
@@ -252,4 +309,69 @@ r += "};\n\n"
 r += `STATIC_ASSERT(${maxParms} <= DEVS_BUILTIN_MAX_ARGS);\n`
 r += `STATIC_ASSERT(${firstFun} == DEVS_FIRST_BUILTIN_FUNCTION);\n`
 
+// must match jd_hash_fnv1a(), used by devs_builtin_string_lookup() in vm_main.c
+function fnv1a(s) {
+    let h = 0x811c9dc5
+    for (const b of Buffer.from(s, "utf8"))
+        h = Math.imul(h ^ b, 0x01000193) >>> 0
+    return h
+}
+
+// hash-and-displace perfect hash of builtin string contents to their index
+function builtinStringHash() {
+    const n = builtinStrings.length
+    if (n != builtinStringIds["__MAX"] + 1)
+        throw new Error(
+            `expecting ${builtinStringIds["__MAX"] + 1} builtin strings, got ${n}`
+        )
+    const hashes = builtinStrings.map(fnv1a)
+    const numBuckets = Math.ceil(n / 4)
+    for (let size = n; size < 4 * n; ++size) {
+        const buckets = []
+        for (let i = 0; i < numBuckets; ++i) buckets.push([])
+        hashes.forEach((h, i) => buckets[h % numBuckets].push(i))
+        const order = buckets
+            .map((b, i) => i)
+            .sort((a, b) => buckets[b].length - buckets[a].length)
+        const slots = []
+        for (let i = 0; i < size; ++i) slots.push(0xffff)
+        const disp = []
+        for (let i = 0; i < numBuckets; ++i) disp.push(0)
+        let ok = true
+        for (const bi of order) {
+            const bucket = buckets[bi]
+            if (bucket.length == 0) break
+            let found = false
+            for (let d = 0; d <= 0xff; ++d) {
+                const taken = bucket.map(i => {
+                    const h = hashes[i]
+                    return ((h + Math.imul(d, (h >>> 16) | 1)) >>> 0) % size
+                })
+                if (
+                    taken.every(
+                        (s, j) => slots[s] == 0xffff && taken.indexOf(s) == j
+                    )
+                ) {
+                    bucket.forEach((i, j) => (slots[taken[j]] = i))
+                    disp[bi] = d
+                    found = true
+                    break
+                }
+            }
+            if (!found) {
+                ok = false
+                break
+            }
+        }
+        if (!ok) continue
+        let r = ""
+        r += `const uint16_t devs_builtin_string_hash_buckets = ${numBuckets};\n`
+        r += `const uint16_t devs_builtin_string_hash_size = ${size};\n`
+        r += `const uint8_t devs_builtin_string_disp[${numBuckets}] = { ${disp.join(", ")} };\n`
+        r += `const uint16_t devs_builtin_string_slots[${size}] = { ${slots.join(", ")} };\n\n`
+        return r
+    }
+    throw new Error("can't build builtin string hash")
+}
+
 fs.writeFileSync(path.dirname(scriptArgs[0]) + "/protogen.c", r)
@@ -0,0 +1,144 @@
+// Host benchmark of the collector alone, with the phases of devs/samples/gc-bench.ts.
+// Only gc_alloc.c is linked in; the few VM functions it calls are stubbed out below.
+// Run with `make gc-bench` in runtime/; the argument is the number of repetitions.
+// Sizes are cut down so that everything fits in a 64k heap.
+
+#include "devs_internal.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define NUM_GLOBALS 2
+
+static devs_gc_t *gc;
+static devs_ctx_t *ctx;
+static value_t globals[NUM_GLOBALS];
+
+uint32_t devs_get_global_flags(void) {
+    return 0;
+}
+void devs_field_ic_invalidate(devs_ctx_t *ctx) {}
+const char *devs_img_fun_name(devs_img_t img, unsigned fidx) {
+    return "?";
+}
+bool devs_maplike_is_map(devs_ctx_t *ctx, devs_maplike_t *m) {
+    return false;
+}
+void devs_oom(devs_ctx_t *ctx, unsigned size) {
+    printf("out of memory allocating %u bytes\n", size);
+    exit(1);
+}
+int devs_string_jmp_init(devs_ctx_t *ctx, devs_string_jmp_t *s) {
+    abort();
+}
+value_t devs_throw_too_big_error(devs_ctx_t *ctx, unsigned s) {
+    abort();
+}
+int devs_utf8_init(const char *data, unsigned size, unsigned *lenp, const devs_utf8_string_t *dst,
+                   unsigned flags) {
+    abort();
+}
+void *devs_value_to_gc_obj(devs_ctx_t *ctx, value_t v) {
+    abort();
+}
+void *jd_alloc(uint32_t sz) {
+    return calloc(1, sz);
+}
+void jd_free(void *p) {
+    free(p);
+}
+void jd_alloc_stack_check(void) {}
+bool target_in_irq(void) {
+    return false;
+}
+uint32_t jd_random(void) {
+    return rand();
+}
+uint64_t tim_get_micros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+void app_dmesg(const char *fmt, ...) {
+    va_list a;
+    va_start(a, fmt);
+    vprintf(fmt, a);
+    va_end(a);
+    printf("\n");
+}
+void jd_panic_core(void) {
+    abort();
+}
+
+value_t devs_value_from_pointer(devs_ctx_t *ctx, int type, void *ptr) {
+    value_t r;
+    r.exp_sign = DEVS_HANDLE_TAG + type;
+    r.mantisa32 = ptr ? (uint8_t *)ptr - (uint8_t *)devs_gc_base_addr(gc) : 0;
+    return r;
+}
+void *devs_handle_ptr_value(devs_ctx_t *ctx, value_t t) {
+    return (uint8_t *)devs_gc_base_addr(gc) + t.mantisa32;
+}
+
+// a linked list of 2-element arrays, rooted in globals[0]
+static void build_list(int len) {
+    for (int i = 0; i < len; ++i) {
+        devs_array_t *a = devs_array_try_alloc(ctx, 2);
+        a->data[0] = globals[0];
+        globals[0] = devs_value_from_gc_obj(ctx, a);
+    }
+}
+
+// an array of 3-element arrays, rooted in globals[1]
+static void build_array(int len) {
+    devs_array_t *arr = devs_array_try_alloc(ctx, len);
+    globals[1] = devs_value_from_gc_obj(ctx, arr);
+    for (int i = 0; i < len; ++i) {
+        devs_array_t *a = devs_array_try_alloc(ctx, 3);
+        arr = devs_handle_ptr_value(ctx, globals[1]);
+        arr->data[i] = devs_value_from_gc_obj(ctx, a);
+        devs_gc_write_barrier(ctx, arr);
+    }
+}
+
+// garbage, while the list and the array stay alive
+static void churn(int rounds) {
+    for (int i = 0; i < rounds; ++i) {
+        devs_array_try_alloc(ctx, 3);
+        if (i % 64 == 0)
+            devs_gc_step(gc);
+    }
+}
+
+int main(int argc, char **argv) {
+    int reps = argc > 1 ? atoi(argv[1]) : 20;
+    uint64_t t_list = 0, t_array = 0, t_churn = 0;
+
+    for (int r = 0; r < reps; ++r) {
+        devs_img_header_t hd = {.num_globals = NUM_GLOBALS};
+        gc = devs_gc_create();
+        ctx = calloc(1, sizeof(*ctx));
+        ctx->gc = gc;
+        ctx->img.header = &hd;
+        ctx->globals = globals;
+        memset(globals, 0, sizeof(globals));
+        devs_gc_set_ctx(gc, ctx);
+
+        uint64_t t0 = tim_get_micros();
+        build_list(400);
+        uint64_t t1 = tim_get_micros();
+        build_array(150);
+        uint64_t t2 = tim_get_micros();
+        churn(20000);
+        uint64_t t3 = tim_get_micros();
+
+        t_list += t1 - t0;
+        t_array += t2 - t1;
+        t_churn += t3 - t2;
+        devs_gc_destroy(gc);
+        free(ctx);
+    }
+
+    printf("list %uus array %uus churn %uus (mean of %d)\n", (unsigned)(t_list / reps),
+           (unsigned)(t_array / reps), (unsigned)(t_churn / reps), reps);
+    return 0;
+}